@@ -0,0 +1,72 @@
+#ifndef _MANDELBROTALIGNEDALLOCATOR
+#define _MANDELBROTALIGNEDALLOCATOR
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Allocator for large numeric buffers.
+// Allocations are aligned to cache lines, and those of at least a huge page are
+// aligned to huge pages and advised to be backed by them where supported.
+// Elements are default initialised, so resizing a vector of numbers leaves the
+// new elements uninitialised instead of zeroing them.
+template <typename T> class AlignedAllocator {
+public:
+    using value_type = T;
+
+    static constexpr std::size_t cacheLineSize = 64;
+    static constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t count) {
+        std::size_t size = count * sizeof(T);
+        if (size < hugePageSize) {
+            return static_cast<T*>(::operator new(
+                size, std::align_val_t(std::max(cacheLineSize, alignof(T)))));
+        }
+
+        // Whole huge pages, so the tail of the buffer can use one too.
+        size = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+        void* pointer = ::operator new(size, std::align_val_t(hugePageSize));
+#ifdef MADV_HUGEPAGE
+        madvise(pointer, size, MADV_HUGEPAGE);
+#endif
+        return static_cast<T*>(pointer);
+    }
+
+    void deallocate(T* pointer, std::size_t count) {
+        std::size_t size = count * sizeof(T);
+        if (size < hugePageSize) {
+            ::operator delete(
+                pointer, std::align_val_t(std::max(cacheLineSize, alignof(T))));
+        } else {
+            ::operator delete(pointer, std::align_val_t(hugePageSize));
+        }
+    }
+
+    // Default initialisation instead of value initialisation.
+    template <typename U>
+    void construct(U* pointer) noexcept(
+        std::is_nothrow_default_constructible_v<U>) {
+        ::new (static_cast<void*>(pointer)) U;
+    }
+    template <typename U, typename... Arguments>
+    void construct(U* pointer, Arguments&&... arguments) {
+        ::new (static_cast<void*>(pointer))
+            U(std::forward<Arguments>(arguments)...);
+    }
+
+    template <typename U> bool operator==(const AlignedAllocator<U>&) const {
+        return true;
+    }
+};
+
+#endif
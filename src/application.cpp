@@ -6,18 +6,30 @@
 #include <SDL3/SDL_render.h>
 #include <SDL3/SDL_stdinc.h>
 #include <SDL3/SDL_surface.h>
+#include <SDL3/SDL_timer.h>
 #include <SDL3/SDL_video.h>
 #include <SDL3_image/SDL_image.h>
 #include <algorithm>
+#include <array>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <SDL3/SDL.h>
 
 #include "grid2d.hpp"
+#include "rawframe.hpp"
 #include "shading.hpp"
 #include "solver.hpp"
+#include "trace.hpp"
 
 std::chrono::_V2::steady_clock::time_point now() {
     return std::chrono::steady_clock::now();
@@ -30,33 +42,94 @@ MandelbrotApplication::MandelbrotApplication() {
 
     isRunning = false;
     frameCounter = 0;
-    animationTime = 0.0;
     animationSpeed = 1.0;
     isFullscreen = false;
+    frameReady = false;
+    isShadingRequested = false;
+    isExportRequested = false;
+    isPreviewShown = true;
+    isRedrawNeeded = false;
 }
 
-void MandelbrotApplication::run() {
-    auto start = now();
-    auto frameStart = start;
+void MandelbrotApplication::setCheckpoint(const std::string& path,
+                                          std::chrono::seconds interval) {
+    checkpointPath = path;
+
+    if (std::filesystem::exists(path)) {
+        try {
+            solver.loadCheckpoint(path);
+        } catch (const std::runtime_error& exception) {
+            std::cerr << "not resuming: " << exception.what() << "\n";
+        }
+    }
 
-    auto delta = start - frameStart;
+    solver.setCheckpoint(path, interval);
+}
+
+void MandelbrotApplication::setExport(const std::string& path) {
+    exportPath = path;
+}
 
+void MandelbrotApplication::run() {
+    solver.setFrameCallback([this] { requestShading(); });
     solverThread = std::jthread(&Solver::calculationLoop, &solver);
 
+    // A small preview with capped iterations, taking a quarter of each refresh
+    // interval at most.
+    auto refresh = std::chrono::microseconds(
+        static_cast<long>(refreshInterval * 1000.0));
+    juliaPreview.emplace(192, 256, refresh / 4, refresh, [this] {
+        SDL_Event readyEvent = {};
+        readyEvent.type = frameReadyEventType;
+        SDL_PushEvent(&readyEvent);
+    });
+
     isRunning = true;
-    draw();
+    shadingThread = std::jthread(&MandelbrotApplication::shadingLoop, this);
 
     while (isRunning) {
         handleEvents();
-        draw();
 
-        frameCounter += 1;
-        delta = now() - frameStart;
-        frameStart = frameStart + delta;
-        animationTime += delta.count() * 0.000000001 * animationSpeed;
+        if (!present()) {
+            // Nothing new to show, sleep until there is input or a new frame.
+            SDL_WaitEvent(nullptr);
+        }
     }
 
     solver.stop();
+    // The shading thread checks isRunning under frameMutex before it waits,
+    // storing it under the lock too means the wakeups below can't be missed.
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        isRunning = false;
+        isShadingRequested = true;
+    }
+    shadingRequested.notify_one();
+    frameConsumed.notify_all();
+    shadingThread.join();
+
+    if (!checkpointPath.empty()) {
+        solverThread.join();
+        try {
+            solver.saveCheckpoint(checkpointPath);
+        } catch (const std::runtime_error& exception) {
+            std::cerr << "checkpoint not saved: " << exception.what() << "\n";
+        }
+    }
+
+    if (!exportPath.empty()) {
+        if (solverThread.joinable()) {
+            solverThread.join();
+        }
+        Solver::FrameData frameData;
+        solver.getFrameData(frameData);
+        exportFrame(frameData);
+    }
+
+    printLatency();
+
+    // Stopped before SDL, which it wakes.
+    juliaPreview.reset();
 
     destroySdl();
 }
@@ -88,11 +161,26 @@ void MandelbrotApplication::initializeSdl() {
 
     renderer = SDL_CreateRenderer(window, NULL);
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderVSync(renderer, 1);
+
+    renderTexture = nullptr;
+    previewTexture = nullptr;
+    textureWidth = 0;
+    textureHeight = 0;
+
+    refreshInterval = 1000.0 / 60.0;
+    auto displayMode = SDL_GetCurrentDisplayMode(displayID);
+    if (displayMode and displayMode->refresh_rate > 0.0f) {
+        refreshInterval = 1000.0 / displayMode->refresh_rate;
+    }
+
+    frameReadyEventType = SDL_RegisterEvents(1);
 
     keyboardState = SDL_GetKeyboardState(NULL);
 }
 void MandelbrotApplication::destroySdl() {
     SDL_DestroyTexture(renderTexture);
+    SDL_DestroyTexture(previewTexture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -125,18 +213,22 @@ void MandelbrotApplication::initializeGrid() {
     // mandelbrotGrid.initializeGrid(displayWidth, displayHeight, 0.330646,
     // -0.39128, 46736.3);
 
-    initializeRenderTexture();
+    initializeRenderTexture(displayWidth, displayHeight);
 }
 
 void MandelbrotApplication::initializeShading() {
-    shading.setShadingFunction(2);
+    shadingFunctionNumber = 2;
+    shading.setShadingFunction(shadingFunctionNumber);
 }
 
-void MandelbrotApplication::initializeRenderTexture() {
+void MandelbrotApplication::initializeRenderTexture(int width, int height) {
     SDL_DestroyTexture(renderTexture);
-    renderTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                      SDL_TEXTUREACCESS_STREAMING, displayWidth,
-                                      displayHeight);
+    renderTexture =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                          SDL_TEXTUREACCESS_STREAMING, width, height);
+    SDL_SetTextureBlendMode(renderTexture, SDL_BLENDMODE_NONE);
+    textureWidth = width;
+    textureHeight = height;
 }
 
 void MandelbrotApplication::handleEvents() {
@@ -154,8 +246,7 @@ void MandelbrotApplication::handleEvents() {
             displayHeight = event.window.data2;
 
             solver.resizeGrid(displayWidth, displayHeight);
-
-            initializeRenderTexture();
+            trackInput(event.common.timestamp);
             break;
         case SDL_EVENT_KEY_DOWN:
             switch (event.key.scancode) {
@@ -172,15 +263,52 @@ void MandelbrotApplication::handleEvents() {
                 break;
             case SDL_SCANCODE_SPACE:
                 solver.toggleJulia();
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
+                break;
+            case SDL_SCANCODE_F:
+                solver.nextFormula();
+                trackInput(event.common.timestamp);
+                break;
+            case SDL_SCANCODE_B:
+                solver.nextRenderMode();
+                trackInput(event.common.timestamp);
+                break;
+            case SDL_SCANCODE_E:
+                solver.toggleDistanceEstimation();
+                trackInput(event.common.timestamp);
+                break;
+            case SDL_SCANCODE_P:
+                if (solver.getScheduling() == Solver::Scheduling::uniform) {
+                    solver.setScheduling(Solver::Scheduling::foveated);
+                    std::cout << "foveated scheduling\n";
+                } else {
+                    solver.setScheduling(Solver::Scheduling::uniform);
+                    std::cout << "uniform scheduling\n";
+                }
+                break;
+            case SDL_SCANCODE_J:
+                isPreviewShown = !isPreviewShown;
+                isRedrawNeeded = true;
+                if (isPreviewShown) {
+                    requestPreview(mousePosition.x, mousePosition.y);
+                }
+                break;
+            case SDL_SCANCODE_T:
+                Trace::dump();
+                break;
+            case SDL_SCANCODE_X:
+                if (!exportPath.empty()) {
+                    isExportRequested = true;
+                    requestShading();
+                }
                 break;
             case SDL_SCANCODE_UP:
                 solver.zoomIn(1.1);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_SCANCODE_DOWN:
                 solver.zoomOut(1.1);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_SCANCODE_LEFT:
                 animationSpeed = std::clamp(animationSpeed / 1.1, 0.05, 20.0);
@@ -190,31 +318,35 @@ void MandelbrotApplication::handleEvents() {
                 break;
             case SDL_SCANCODE_W:
                 solver.move(0.0, 0.1);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_SCANCODE_S:
                 solver.move(0.0, -0.1);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_SCANCODE_A:
                 solver.move(-0.1, 0.0);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_SCANCODE_D:
                 solver.move(0.1, 0.0);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_SCANCODE_1:
-                shading.setShadingFunction(0);
+                shadingFunctionNumber = 0;
+                requestShading();
                 break;
             case SDL_SCANCODE_2:
-                shading.setShadingFunction(1);
+                shadingFunctionNumber = 1;
+                requestShading();
                 break;
             case SDL_SCANCODE_3:
-                shading.setShadingFunction(2);
+                shadingFunctionNumber = 2;
+                requestShading();
                 break;
             case SDL_SCANCODE_4:
-                shading.setShadingFunction(3);
+                shadingFunctionNumber = 3;
+                requestShading();
                 break;
             default:
                 break;
@@ -224,96 +356,315 @@ void MandelbrotApplication::handleEvents() {
             switch (event.button.button) {
             case SDL_BUTTON_LEFT:
                 solver.zoomOnPixel(event.button.x, event.button.y, 2.0);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             case SDL_BUTTON_RIGHT:
                 solver.zoomOut(2.0);
-                initializeRenderTexture();
+                trackInput(event.common.timestamp);
                 break;
             default:
                 break;
             }
             break;
+        case SDL_EVENT_MOUSE_MOTION:
+            solver.setFocus(event.motion.x, event.motion.y);
+            if (isPreviewShown) {
+                requestPreview(event.motion.x, event.motion.y);
+            }
+            break;
         default:
             break;
         }
     }
 }
 
-void MandelbrotApplication::draw() {
-    int iterationCount;
-    int escapeCount;
-    Grid2d<double> magnitudeSquaredGrid;
-    Grid2d<int> iterationGrid;
-    std::vector<int> escapeIterationCounterSums;
-
-    solver.getFrameData(iterationCount, escapeCount, magnitudeSquaredGrid,
-                        iterationGrid, escapeIterationCounterSums);
-
-    auto smoothEscapeIterationCounterSum =
-        [escapeIterationCounterSums](
-            const double escapeIterationCount) -> double {
-        int a = std::max(static_cast<int>(floor(escapeIterationCount)), 0);
-
-        int b =
-            std::min(static_cast<int>(ceil(escapeIterationCount)),
-                     static_cast<int>(escapeIterationCounterSums.size()) - 1);
-
-        if (b <= a)
-            return escapeIterationCounterSums[static_cast<int>(
-                escapeIterationCount)];
-
-        double i = static_cast<double>(escapeIterationCount - a) /
-                   static_cast<double>(b - a);
-        return escapeIterationCounterSums[a] +
-               i * (escapeIterationCounterSums[b] -
-                    escapeIterationCounterSums[a]);
+void MandelbrotApplication::trackInput(std::uint64_t timestamp) {
+    pendingInputs.emplace_back(solver.getSubmittedCommandCount(), timestamp);
+}
+
+void MandelbrotApplication::requestPreview(float x, float y) {
+    const Solver::View& view = presentedFrame.view;
+    if (!view.mandelbrotMode or view.width == 0 or displayWidth == 0 or
+        displayHeight == 0) {
+        return;
+    }
+
+    // The frame may still have the size from before a resize.
+    juliaPreview->request(
+        view.formula,
+        view.pixelToComplex(x * view.width / displayWidth - 0.5,
+                            y * view.height / displayHeight - 0.5));
+}
+
+void MandelbrotApplication::printLatency() {
+    std::vector<double> previewLatencies = juliaPreview->latencies();
+    if (!previewLatencies.empty()) {
+        std::sort(previewLatencies.begin(), previewLatencies.end());
+        std::cout << "julia preview latency over " << previewLatencies.size()
+                  << " previews: median "
+                  << previewLatencies[previewLatencies.size() / 2]
+                  << " ms, p99 "
+                  << previewLatencies[(previewLatencies.size() - 1) * 99 / 100]
+                  << " ms\n";
+    }
+
+    if (inputLatencies.empty()) {
+        return;
+    }
+
+    std::vector<double> latencies = inputLatencies;
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    std::size_t withinRefresh = 0;
+    for (double latency : latencies) {
+        sum += latency;
+        if (latency <= refreshInterval) {
+            withinRefresh++;
+        }
+    }
+
+    std::cout << "input-to-photon latency over " << latencies.size()
+              << " inputs: mean " << sum / latencies.size() << " ms, p99 "
+              << latencies[(latencies.size() - 1) * 99 / 100] << " ms, max "
+              << latencies.back() << " ms\n"
+              << withinRefresh << " inputs within one refresh interval of "
+              << refreshInterval << " ms, " << frameCounter
+              << " frames presented\n";
+}
+
+void MandelbrotApplication::shadingLoop() {
+    Trace::setThreadName("shading");
+    Solver::FrameData frameData;
+    unsigned long shadedVersion = 0;
+    int shadedFunctionNumber = -1;
+
+    double animationTime = 0.0;
+    auto frameStart = now();
+
+    while (isRunning) {
+        auto delta = now() - frameStart;
+        frameStart += delta;
+        animationTime +=
+            std::chrono::duration<double>(delta).count() * animationSpeed;
+
+        int functionNumber = shadingFunctionNumber;
+        if (functionNumber != shadedFunctionNumber) {
+            shading.setShadingFunction(functionNumber);
+        }
+
+        if (isExportRequested.exchange(false)) {
+            exportFrame(frameData);
+        }
+
+        // Skip frames when neither the solver's data nor the shading changed.
+        unsigned long version = solver.getFrameVersion();
+        if (version == 0 or
+            (version == shadedVersion and
+             functionNumber == shadedFunctionNumber and
+             !shading.isAnimated())) {
+            TRACE_SCOPE("wait for shading request");
+            std::unique_lock<std::mutex> lock(frameMutex);
+            shadingRequested.wait(lock, [this] {
+                return isShadingRequested or !isRunning;
+            });
+            isShadingRequested = false;
+            continue;
+        }
+
+        if (version != shadedVersion) {
+            solver.getFrameData(frameData);
+            shadedVersion = version;
+        }
+        shadedFunctionNumber = functionNumber;
+
+        if (frameData.smoothIterationGrid.size() == 0) {
+            continue;
+        }
+
+        shadeFrame(frameData, animationTime, shadingFrame);
+
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            std::swap(shadingFrame, readyFrame);
+            frameReady = true;
+        }
+
+        SDL_Event readyEvent = {};
+        readyEvent.type = frameReadyEventType;
+        SDL_PushEvent(&readyEvent);
+
+        // Don't shade further ahead than presentation.
+        TRACE_SCOPE("wait for presentation");
+        std::unique_lock<std::mutex> lock(frameMutex);
+        frameConsumed.wait(lock, [this] { return !frameReady or !isRunning; });
+    }
+}
+
+void MandelbrotApplication::requestShading() {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        isShadingRequested = true;
+    }
+    shadingRequested.notify_one();
+}
+
+void MandelbrotApplication::shadeFrame(const Solver::FrameData& frameData,
+                                       double animationTime,
+                                       ShadedFrame& frame) {
+    TRACE_SCOPE("shade");
+    const auto& smoothIterationGrid = frameData.smoothIterationGrid;
+    const auto& escapeHistogram = frameData.escapeHistogram;
+    const auto& distanceGrid = frameData.distanceGrid;
+
+    auto toArgb = [](Shading::Colour colour) -> std::uint32_t {
+        return 0xff000000u | (get<0>(colour) << 16) | (get<1>(colour) << 8) |
+               get<2>(colour);
     };
 
+    frame.width = smoothIterationGrid.width();
+    frame.height = smoothIterationGrid.height();
+    frame.appliedCommandCount = frameData.appliedCommandCount;
+    frame.view = frameData.view;
+    frame.pixels.resize(smoothIterationGrid.size());
+
+    if (frameData.renderMode != Solver::RenderMode::escapeTime) {
+        // Square root of the orbit density relative to the densest pixel.
+        std::array<double, 3> channelScales;
+        for (int channel = 0; channel < 3; channel++) {
+            channelScales[channel] =
+                1.0 / std::max(frameData.densityMaxima[channel], 1u);
+        }
+        for (std::size_t i = 0; i < frame.pixels.size(); i++) {
+            std::uint32_t pixel = 0xff000000u;
+            for (int channel = 0; channel < 3; channel++) {
+                double density = frameData.densityGrids[channel][i] *
+                                 channelScales[channel];
+                pixel |= static_cast<std::uint32_t>(255.0 * std::sqrt(density))
+                         << (16 - 8 * channel);
+            }
+            frame.pixels[i] = pixel;
+        }
+        return;
+    }
+
     double escapeIterationCount;
     double histogramFactor;
-    Shading::Colour colour;
-
-    colour = shading.shade(1.0, animationTime);
-    SDL_SetRenderDrawColor(renderer, get<0>(colour), get<1>(colour),
-                           get<2>(colour), 255);
-    SDL_RenderClear(renderer);
-
-    SDL_LockTexture(renderTexture, NULL,
-                    reinterpret_cast<void**>(&texturePixels), &texturePitch);
-
-    for (unsigned int y = 0; y < iterationGrid.height(); y++) {
-        for (unsigned int x = 0; x < iterationGrid.width(); x++) {
-            if (magnitudeSquaredGrid[x, y] > 2.0 * 2.0) {
-                // calculate continuous number of iterations to escape
-                escapeIterationCount =
-                    (iterationGrid[x, y] -
-                     log2(log2(magnitudeSquaredGrid[x, y]))) +
-                    5;
-                // get Lerped summed histogram for continuous histogram shading
-                histogramFactor = smoothEscapeIterationCounterSum(
-                                      escapeIterationCount - 1.0) /
-                                  static_cast<double>(escapeCount);
-
-                colour = shading.shade(histogramFactor, animationTime);
-
-                texturePixels[y * texturePitch + x * 4] =
-                    static_cast<unsigned char>(get<2>(colour));
-                texturePixels[y * texturePitch + x * 4 + 1] =
-                    static_cast<unsigned char>(get<1>(colour));
-                texturePixels[y * texturePitch + x * 4 + 2] =
-                    static_cast<unsigned char>(get<0>(colour));
-                texturePixels[y * texturePitch + x * 4 + 3] =
-                    static_cast<unsigned char>(255);
+
+    const std::uint32_t background = toArgb(shading.shade(1.0, animationTime));
+
+    for (std::size_t i = 0; i < smoothIterationGrid.size(); i++) {
+        if (smoothIterationGrid[i] >= 0.0f) {
+            // continuous number of iterations to escape
+            escapeIterationCount = smoothIterationGrid[i] + 5;
+            // lerped cumulative histogram for continuous histogram shading
+            histogramFactor =
+                escapeHistogram.fraction(escapeIterationCount - 1.0);
+
+            if (distanceGrid.size() == 0) {
+                frame.pixels[i] =
+                    toArgb(shading.shade(histogramFactor, animationTime));
+            } else {
+                frame.pixels[i] = toArgb(shading.shadeWithDistance(
+                    histogramFactor, distanceGrid[i], animationTime));
             }
+        } else {
+            frame.pixels[i] = background;
+        }
+    }
+}
+
+void MandelbrotApplication::exportFrame(const Solver::FrameData& frameData) {
+    if (frameData.smoothIterationGrid.size() == 0 or
+        frameData.renderMode != Solver::RenderMode::escapeTime) {
+        std::cerr << "export skipped, no escape time frame to export\n";
+        return;
+    }
+
+    TRACE_SCOPE("export");
+    try {
+        RawFrame::fromFrameData(frameData, frameData.iterationMaximum)
+            .write(exportPath, RawFrame::Compression::zlib);
+        std::cout << "exported " << exportPath << "\n";
+    } catch (const std::runtime_error& exception) {
+        std::cerr << "export failed: " << exception.what() << "\n";
+    }
+}
+
+bool MandelbrotApplication::present() {
+    bool isNewFrame = false;
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        if (frameReady) {
+            std::swap(readyFrame, presentedFrame);
+            frameReady = false;
+            isNewFrame = true;
+        }
+    }
+
+    if (isNewFrame) {
+        frameConsumed.notify_one();
+
+        if (presentedFrame.width != textureWidth or
+            presentedFrame.height != textureHeight) {
+            initializeRenderTexture(presentedFrame.width,
+                                    presentedFrame.height);
         }
+
+        TRACE_SCOPE("texture upload");
+        SDL_UpdateTexture(renderTexture, NULL, presentedFrame.pixels.data(),
+                          presentedFrame.width * 4);
     }
 
-    SDL_UnlockTexture(renderTexture);
+    int previewSize = previewFrame.size;
+    bool isNewPreview = juliaPreview->takeFrame(previewFrame);
+    if (isNewPreview) {
+        if (previewTexture == nullptr or previewFrame.size != previewSize) {
+            SDL_DestroyTexture(previewTexture);
+            previewTexture = SDL_CreateTexture(
+                renderer, SDL_PIXELFORMAT_ARGB8888,
+                SDL_TEXTUREACCESS_STREAMING, previewFrame.size,
+                previewFrame.size);
+        }
+        SDL_UpdateTexture(previewTexture, NULL, previewFrame.pixels.data(),
+                          previewFrame.size * 4);
+    }
 
-    SDL_SetTextureBlendMode(renderTexture, SDL_BLENDMODE_BLEND);
+    if (!isNewFrame and !isNewPreview and !isRedrawNeeded) {
+        return false;
+    }
+    isRedrawNeeded = false;
 
     SDL_RenderTexture(renderer, renderTexture, NULL, NULL);
 
-    SDL_RenderPresent(renderer);
+    if (isPreviewShown and presentedFrame.view.mandelbrotMode and
+        previewTexture != nullptr) {
+        // Bottom right corner, a third of the shorter side of the window.
+        float side = std::min(displayWidth, displayHeight) / 3.0f;
+        float margin = side / 16.0f;
+        SDL_FRect inset = {displayWidth - side - margin,
+                           displayHeight - side - margin, side, side};
+        SDL_RenderTexture(renderer, previewTexture, NULL, &inset);
+    }
+
+    // Blocks until the next vertical blank with vsync on.
+    {
+        TRACE_SCOPE("present");
+        SDL_RenderPresent(renderer);
+    }
+    frameCounter++;
+
+    if (!isNewFrame) {
+        return true;
+    }
+
+    std::uint64_t presentTime = SDL_GetTicksNS();
+    while (!pendingInputs.empty() and
+           pendingInputs.front().first <= presentedFrame.appliedCommandCount) {
+        inputLatencies.push_back(
+            static_cast<double>(presentTime - pendingInputs.front().second) *
+            1e-6);
+        pendingInputs.pop_front();
+    }
+
+    return true;
 }
@@ -1,11 +1,21 @@
 #ifndef _MANDELBROTAPPLICATION
 #define _MANDELBROTAPPLICATION
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <SDL3/SDL.h>
 
+#include "juliapreview.hpp"
 #include "shading.hpp"
 #include "solver.hpp"
 
@@ -13,17 +23,37 @@ std::chrono::_V2::steady_clock::time_point now();
 
 // Wrapper class for the application.
 // Due to being lazy, holds the code for SDL3.
+// Runs as three stages on their own threads: input and presentation on the
+// main thread, shading on the shading thread and the solver on its own thread.
+// Presentation is paced by vsync, and only happens when a new frame is shaded.
+// Every stage sleeps while there is nothing new, shading is woken by the
+// solver's frame callback and presentation by SDL events.
+// In mandelbrot mode an inset previews the julia set of the point under the
+// cursor, rendered on a worker of its own.
 class MandelbrotApplication {
 public:
     MandelbrotApplication();
 
+    // Resumes from the checkpoint at path if there is one, then writes
+    // checkpoints to it every interval and on exit.
+    void setCheckpoint(const std::string& path, std::chrono::seconds interval);
+
+    // Writes the shown frame unshaded to path as a raw frame on X and on exit,
+    // to recolour later with --recolour.
+    void setExport(const std::string& path);
+
     void run();
 
 private:
-    bool isRunning;
+    std::string checkpointPath;
+    std::string exportPath;
+    // Set on X, the shading thread writes the export.
+    std::atomic_bool isExportRequested;
+
+    std::atomic_bool isRunning;
     int frameCounter;
-    double animationTime;
-    double animationSpeed;
+    std::atomic<double> animationSpeed;
+    std::atomic_int shadingFunctionNumber;
     unsigned int displayWidth, displayHeight;
     bool isFullscreen;
 
@@ -31,8 +61,7 @@ private:
     SDL_Renderer* renderer;
 
     SDL_Texture* renderTexture;
-    unsigned char* texturePixels;
-    int texturePitch;
+    int textureWidth, textureHeight;
 
     SDL_Event event;
     const bool* keyboardState;
@@ -44,6 +73,40 @@ private:
 
     Shading shading;
 
+    // Shaded ARGB pixels, passed from the shading thread to presentation.
+    struct ShadedFrame {
+        std::vector<std::uint32_t> pixels;
+        int width = 0, height = 0;
+        unsigned long appliedCommandCount = 0;
+        Solver::View view;
+    };
+    // Triple buffered: shading writes shadingFrame, then swaps it with
+    // readyFrame, which presentation swaps with presentedFrame.
+    ShadedFrame shadingFrame, readyFrame, presentedFrame;
+    bool frameReady;
+    std::mutex frameMutex;
+    std::condition_variable frameConsumed;
+    // Wakes the shading thread for a new solver frame or shading function.
+    bool isShadingRequested;
+    std::condition_variable shadingRequested;
+    // SDL event pushed when a frame is ready, waking the main thread.
+    std::uint32_t frameReadyEventType;
+    std::jthread shadingThread;
+
+    // Navigation inputs waiting to be presented, as the submitted command
+    // count after the input and the input's timestamp in nanoseconds.
+    std::deque<std::pair<unsigned long, std::uint64_t>> pendingInputs;
+    // Input-to-photon latencies in milliseconds.
+    std::vector<double> inputLatencies;
+    double refreshInterval;
+
+    std::optional<JuliaPreview> juliaPreview;
+    JuliaPreview::Frame previewFrame;
+    SDL_Texture* previewTexture;
+    bool isPreviewShown;
+    // Set when the presented image changes without a new frame.
+    bool isRedrawNeeded;
+
     void initializeSdl();
     void destroySdl();
 
@@ -51,11 +114,31 @@ private:
 
     void initializeShading();
 
-    void initializeRenderTexture();
+    void initializeRenderTexture(int width, int height);
 
     void handleEvents();
 
-    void draw();
+    // Records a navigation input to measure its latency once presented.
+    void trackInput(std::uint64_t timestamp);
+
+    void printLatency();
+
+    // Requests a julia preview for the point under the window coordinates.
+    void requestPreview(float x, float y);
+
+    // Shades frames on the shading thread whenever the solver has new data or
+    // the shading is animated.
+    void shadingLoop();
+    void requestShading();
+
+    void shadeFrame(const Solver::FrameData& frameData, double animationTime,
+                    ShadedFrame& frame);
+
+    void exportFrame(const Solver::FrameData& frameData);
+
+    // Presents a newly shaded frame or julia preview, if there is one. Returns
+    // false if there was nothing new.
+    bool present();
 };
 
 #endif
@@ -0,0 +1,343 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "escapehistogram.hpp"
+#include "formula.hpp"
+#include "grid2d.hpp"
+#include "pngwriter.hpp"
+#include "rawframe.hpp"
+#include "shading.hpp"
+#include "solver.hpp"
+#include "threadconfig.hpp"
+#include "trace.hpp"
+
+namespace {
+
+template <typename T> bool parseNumber(std::string_view text, T& value) {
+    auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc() and end == text.data() + text.size();
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+} // namespace
+
+BatchRenderer::BatchRenderer(unsigned int workerCount)
+    : m_workerCount(std::max(workerCount, 1u)) {}
+
+std::vector<BatchRenderer::Job>
+BatchRenderer::parseManifest(std::istream& manifest) {
+    std::vector<Job> jobs;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line)) {
+        lineNumber++;
+        std::istringstream stream(line);
+        std::vector<std::string> fields;
+        for (std::string field; stream >> field;) {
+            fields.push_back(field);
+        }
+        if (fields.empty() or fields[0][0] == '#') {
+            continue;
+        }
+
+        auto invalid = [lineNumber](const std::string& reason) {
+            return std::runtime_error("manifest line " +
+                                      std::to_string(lineNumber) + ": " +
+                                      reason);
+        };
+        if (fields.size() < 8 or fields.size() > 10) {
+            throw invalid("expected <output.png> <width> <height> <formula> "
+                          "<m|real,imag> <real> <imag> <scale> [<palette> "
+                          "[<iterations>]]");
+        }
+
+        Job job;
+        job.output = fields[0];
+        if (!parseNumber(fields[1], job.width) or
+            !parseNumber(fields[2], job.height) or job.width <= 0 or
+            job.height <= 0) {
+            throw invalid("invalid size");
+        }
+
+        std::optional<Formula> formula = formulaFromSlug(fields[3]);
+        if (!formula) {
+            throw invalid("unknown formula " + fields[3]);
+        }
+        job.formula = *formula;
+
+        std::string_view constant = fields[4];
+        if (constant != "m") {
+            std::size_t comma = constant.find(',');
+            if (comma == std::string_view::npos or
+                !parseNumber(constant.substr(0, comma), job.constantReal) or
+                !parseNumber(constant.substr(comma + 1), job.constantImag)) {
+                throw invalid("constant must be m or <real>,<imag>");
+            }
+            job.mandelbrotMode = false;
+        }
+
+        if (!parseNumber(fields[5], job.viewCenterReal) or
+            !parseNumber(fields[6], job.viewCenterImag) or
+            !parseNumber(fields[7], job.viewScale) or !(job.viewScale > 0.0)) {
+            throw invalid("invalid view");
+        }
+        if (fields.size() > 8 and
+            (!parseNumber(fields[8], job.palette) or job.palette < 0 or
+             job.palette > 3)) {
+            throw invalid("palette must be from 0 to 3");
+        }
+        if (fields.size() > 9 and
+            (!parseNumber(fields[9], job.iterationMaximum) or
+             job.iterationMaximum <= 0)) {
+            throw invalid("invalid iteration count");
+        }
+
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+std::vector<BatchRenderer::Report>
+BatchRenderer::render(const std::vector<Job>& jobs) {
+    auto start = std::chrono::steady_clock::now();
+
+    struct Band {
+        std::size_t job;
+        int firstRow, rowCount;
+    };
+    // Images are assembled from their bands as they finish, their grids are
+    // only allocated while they are being rendered.
+    struct Image {
+        std::mutex mutex;
+        Grid2d<float> smoothIterationGrid;
+        EscapeHistogram::Table escapeHistogram;
+        int remainingBands = 0;
+        bool isStarted = false;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    std::vector<Band> bands;
+    std::vector<Image> images(jobs.size());
+    std::vector<Report> reports(jobs.size());
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        const Job& job = jobs[i];
+        int rows = std::clamp<std::size_t>(bandPixels / job.width, 1,
+                                           job.height);
+        for (int firstRow = 0; firstRow < job.height; firstRow += rows) {
+            bands.push_back(
+                {i, firstRow, std::min(rows, job.height - firstRow)});
+            images[i].remainingBands++;
+        }
+        reports[i].bandCount = images[i].remainingBands;
+    }
+
+    std::atomic_size_t nextBand = 0;
+
+    auto workLoop = [&](unsigned int worker) {
+        std::vector<int> cpus = ThreadConfig::current().workerCpus();
+        if (!cpus.empty()) {
+            pinCurrentThread(cpus[worker % cpus.size()]);
+        }
+        Trace::setThreadName("batch worker");
+        ThreadConfig singleThread;
+        singleThread.setThreadCount(1);
+
+        Solver solver;
+        solver.setVerbose(false);
+        solver.setThreadConfig(singleThread);
+        int iterationMaximum = solver.getMaxIterationCount();
+        Solver::FrameData frameData;
+
+        for (std::size_t i = nextBand++; i < bands.size(); i = nextBand++) {
+            const Band& band = bands[i];
+            const Job& job = jobs[band.job];
+            Image& image = images[band.job];
+            Report& report = reports[band.job];
+
+            auto bandStart = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(image.mutex);
+                if (!image.isStarted) {
+                    image.isStarted = true;
+                    image.start = bandStart;
+                    image.smoothIterationGrid.resize(job.width, job.height);
+                }
+            }
+
+            // Bands are views of the same scale, shifted down by whole
+            // pixels, as in poster rendering.
+            if (job.iterationMaximum != iterationMaximum) {
+                iterationMaximum = job.iterationMaximum;
+                solver.setMaxIterationCount(iterationMaximum);
+            }
+            double pixelSize = 4.0 / (job.viewScale * job.width);
+            double bandCenterImag =
+                job.viewCenterImag +
+                (0.5 * job.height - band.firstRow - 0.5 * band.rowCount) *
+                    pixelSize;
+            solver.setFormula(job.formula);
+            solver.setFractal(job.mandelbrotMode, job.constantReal,
+                              job.constantImag);
+            solver.initializeGrid(job.width, band.rowCount, job.viewCenterReal,
+                                  bandCenterImag, job.viewScale);
+            {
+                TRACE_SCOPE("batch band");
+                solver.solve();
+            }
+            solver.getFrameData(frameData);
+            double solveSeconds = secondsSince(bandStart);
+
+            bool isLastBand;
+            {
+                std::lock_guard<std::mutex> lock(image.mutex);
+                for (int y = 0; y < band.rowCount; y++) {
+                    std::ranges::copy(
+                        frameData.smoothIterationGrid.row(y),
+                        image.smoothIterationGrid.row(band.firstRow + y)
+                            .begin());
+                }
+
+                // Cumulative counts of bands with the same iteration maximum
+                // add up to the image's.
+                auto& counts = image.escapeHistogram.cumulativeCounts;
+                const auto& bandCounts =
+                    frameData.escapeHistogram.cumulativeCounts;
+                counts.resize(bandCounts.size(), 0.0f);
+                for (std::size_t bin = 0; bin < counts.size(); bin++) {
+                    counts[bin] += bandCounts[bin];
+                }
+
+                report.solveSeconds += solveSeconds;
+                isLastBand = --image.remainingBands == 0;
+            }
+            if (!isLastBand) {
+                continue;
+            }
+
+            EscapeHistogram::Table& table = image.escapeHistogram;
+            float escapeCount = table.cumulativeCounts.empty()
+                                    ? 0.0f
+                                    : table.cumulativeCounts.back();
+            table.scale = escapeCount > 0.0f ? 1.0f / escapeCount : 0.0f;
+
+            auto writeStart = std::chrono::steady_clock::now();
+            try {
+                TRACE_SCOPE("batch write");
+                if (job.output.ends_with(RawFrame::extension)) {
+                    writeRawFrame(job, image.smoothIterationGrid, table);
+                } else {
+                    writeImage(job, image.smoothIterationGrid, table);
+                }
+                report.isWritten = true;
+            } catch (const std::exception& exception) {
+                report.error = exception.what();
+            }
+            report.writeSeconds = secondsSince(writeStart);
+            report.latencySeconds = secondsSince(image.start);
+            report.finishSeconds = secondsSince(start);
+
+            image.smoothIterationGrid = Grid2d<float>();
+            table = EscapeHistogram::Table();
+        }
+    };
+
+    {
+        std::vector<std::jthread> workers;
+        for (unsigned int i = 0; i < m_workerCount; i++) {
+            workers.emplace_back(workLoop, i);
+        }
+    }
+
+    return reports;
+}
+
+void BatchRenderer::writeReport(const std::vector<Job>& jobs,
+                                const std::vector<Report>& reports,
+                                std::ostream& output) {
+    output << "output,width,height,bands,solve_seconds,write_seconds,"
+              "latency_seconds,finish_seconds,written\n";
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        const Job& job = jobs[i];
+        const Report& report = reports[i];
+        output << job.output << "," << job.width << "," << job.height << ","
+               << report.bandCount << "," << report.solveSeconds << ","
+               << report.writeSeconds << "," << report.latencySeconds << ","
+               << report.finishSeconds << ","
+               << (report.isWritten ? "yes" : "no") << "\n";
+    }
+}
+
+void BatchRenderer::writeImage(const Job& job,
+                               const Grid2d<float>& smoothIterationGrid,
+                               const EscapeHistogram::Table& escapeHistogram) {
+    Shading shading;
+    shading.setShadingFunction(job.palette);
+    Shading::Colour background = shading.shade(1.0, 0.0);
+
+    PngWriter writer(job.output, smoothIterationGrid.width(),
+                     smoothIterationGrid.height());
+    std::vector<unsigned char> pixels(smoothIterationGrid.width() * 3);
+    for (std::size_t y = 0; y < smoothIterationGrid.height(); y++) {
+        std::span<const float> row = smoothIterationGrid.row(y);
+        for (std::size_t x = 0; x < row.size(); x++) {
+            Shading::Colour colour = background;
+            if (row[x] >= 0.0f) {
+                colour = shading.shade(escapeHistogram.fraction(row[x] + 4.0),
+                                       0.0);
+            }
+            pixels[x * 3] = static_cast<unsigned char>(get<0>(colour));
+            pixels[x * 3 + 1] = static_cast<unsigned char>(get<1>(colour));
+            pixels[x * 3 + 2] = static_cast<unsigned char>(get<2>(colour));
+        }
+        writer.writeRows(pixels.data(), 1);
+    }
+    writer.finish();
+}
+
+void BatchRenderer::writeRawFrame(
+    const Job& job, const Grid2d<float>& smoothIterationGrid,
+    const EscapeHistogram::Table& escapeHistogram) {
+    RawFrame frame = {};
+    RawFrame::Header& header = frame.header;
+    header.width = job.width;
+    header.height = job.height;
+    header.viewCenterReal = job.viewCenterReal;
+    header.viewCenterImag = job.viewCenterImag;
+    header.viewScale = job.viewScale;
+    header.constantReal = job.constantReal;
+    header.constantImag = job.constantImag;
+    header.formula = static_cast<std::int32_t>(job.formula);
+    header.mandelbrotMode = job.mandelbrotMode;
+    header.iterationMaximum = job.iterationMaximum;
+    if (!escapeHistogram.cumulativeCounts.empty()) {
+        header.escapeCount = static_cast<std::int32_t>(
+            escapeHistogram.cumulativeCounts.back());
+    }
+
+    frame.smoothIterations = smoothIterationGrid.elements();
+    frame.cumulativeCounts = escapeHistogram.cumulativeCounts;
+    frame.write(job.output, RawFrame::Compression::zlib);
+}
@@ -0,0 +1,88 @@
+#ifndef _MANDELBROTBATCH
+#define _MANDELBROTBATCH
+
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "escapehistogram.hpp"
+#include "formula.hpp"
+#include "grid2d.hpp"
+
+// Renders a manifest of views to PNG files for batch jobs like thumbnails.
+// Whole images are scheduled across workers instead of parallelising each
+// image, which at small sizes spends more time starting threads per pass than
+// iterating. Images over bandPixels are split into bands of rows that workers
+// render independently, so a few large images still spread over every worker.
+// Each worker has its own single threaded solver. Bands are taken in manifest
+// order, and the worker that finishes an image's last band shades and writes
+// it with the image's combined escape histogram. Outputs ending in .mbraw are
+// written unshaded as compressed raw frames instead, to recolour later.
+// Manifest lines are
+//   <output.png> <width> <height> <formula> <m|real,imag> <real> <imag>
+//   <scale> [<palette> [<iterations>]]
+// where formula is named as in tile paths, e.g. burning-ship, and constant m
+// is the mandelbrot set. Palette selects a shading function from 0 to 3,
+// default 2, and iterations default to 1024. Blank lines and lines starting
+// with # are skipped.
+class BatchRenderer {
+public:
+    struct Job {
+        std::string output;
+        int width = 0, height = 0;
+        Formula formula = Formula::mandelbrot;
+        bool mandelbrotMode = true;
+        double constantReal = 0.0, constantImag = 0.0;
+        double viewCenterReal = -0.5, viewCenterImag = 0.0, viewScale = 1.0;
+        int palette = 2;
+        int iterationMaximum = 1024;
+    };
+
+    // Timings of a job in seconds.
+    struct Report {
+        int bandCount = 0;
+        // Solver time summed over bands.
+        double solveSeconds = 0.0;
+        double writeSeconds = 0.0;
+        // From starting the first band until the image was written.
+        double latencySeconds = 0.0;
+        // Since render() started, when the image was written.
+        double finishSeconds = 0.0;
+        bool isWritten = false;
+        // Why the image couldn't be written, or empty.
+        std::string error;
+    };
+
+    static constexpr std::size_t bandPixels = 1 << 16;
+
+    explicit BatchRenderer(unsigned int workerCount);
+
+    // Throws std::runtime_error naming the first invalid line.
+    static std::vector<Job> parseManifest(std::istream& manifest);
+
+    // Renders every job and returns their reports in job order. Images that
+    // can't be written don't stop the others, their reports hold the error.
+    std::vector<Report> render(const std::vector<Job>& jobs);
+
+    // Writes one CSV line per job.
+    static void writeReport(const std::vector<Job>& jobs,
+                            const std::vector<Report>& reports,
+                            std::ostream& output);
+
+    // Shades an image by histogram colouring with the job's palette and
+    // writes it to the job's output.
+    static void writeImage(const Job& job,
+                           const Grid2d<float>& smoothIterationGrid,
+                           const EscapeHistogram::Table& escapeHistogram);
+    // Writes an image as a raw frame to the job's output.
+    static void writeRawFrame(const Job& job,
+                              const Grid2d<float>& smoothIterationGrid,
+                              const EscapeHistogram::Table& escapeHistogram);
+
+private:
+    unsigned int m_workerCount;
+};
+
+#endif
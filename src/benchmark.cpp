@@ -0,0 +1,1656 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "batch.hpp"
+#include "escapehistogram.hpp"
+#include "formula.hpp"
+#include "grid2d.hpp"
+#include "juliapreview.hpp"
+#include "pointsolver.hpp"
+#include "rawframe.hpp"
+#include "recolour.hpp"
+#include "shading.hpp"
+#include "solver.hpp"
+#include "threadconfig.hpp"
+#include "tileserver.hpp"
+
+#if defined(__unix__) or defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define MANDELBROT_SOCKETS
+#endif
+
+namespace {
+
+struct Location {
+    std::string_view name;
+    double viewCenterReal, viewCenterImag, viewScale;
+};
+
+constexpr std::array<Location, 4> testLocations = {{
+    {"default", -0.5, 0.0, 1.0},
+    {"nice spiral", -0.190564, 0.668407, 38294.6},
+    {"seahorse valley", -0.747089, 0.100153, 955.594},
+    {"high detail", 0.330646, -0.39128, 46736.3},
+}};
+
+// CPU time used by every thread of the process.
+double processCpuSeconds() {
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// Straightforward reference iteration, deliberately independent of the
+// solver's kernels.
+std::complex<double> referenceStep(Formula formula, std::complex<double> z,
+                                   std::complex<double> c) {
+    switch (formula) {
+    case Formula::burningShip:
+        z = {std::abs(z.real()), std::abs(z.imag())};
+        return z * z + c;
+    case Formula::tricorn:
+        z = std::conj(z);
+        return z * z + c;
+    case Formula::multibrot3:
+        return z * z * z + c;
+    case Formula::multibrot4:
+        return z * z * z * z + c;
+    case Formula::mandelbrot:
+    default:
+        return z * z + c;
+    }
+}
+
+// Centre of pixel (x, y) of a view, with the same arithmetic as
+// Solver::mapToComplex, so the reference iterates bit-identical points.
+std::complex<double> pixelPoint(int x, int y, int width, int height,
+                                double viewCenterReal, double viewCenterImag,
+                                double viewScale) {
+    double real = x + 0.5;
+    double imag = y + 0.5;
+    double realRange = 4.0 / viewScale;
+    double imagRange =
+        realRange * (static_cast<double>(height) / static_cast<double>(width));
+    real *= realRange / width;
+    imag *= imagRange / height;
+    real += viewCenterReal - (2.0 / viewScale);
+    double aspectRatio =
+        static_cast<double>(width) / static_cast<double>(height);
+    imag += viewCenterImag - (2.0 / (viewScale * aspectRatio));
+    imag = 2.0 * viewCenterImag - imag;
+    return {real, imag};
+}
+
+struct LayoutTimes {
+    double solverSeconds, drawSeconds;
+    std::uint32_t checksum;
+};
+
+// A frame to solve and shade on grids of every layout.
+struct LayoutFrame {
+    int width, height;
+    unsigned int iterationMaximum;
+    Location location;
+    EscapeHistogram::Table escapeHistogram;
+};
+
+// The solver's kernel writes pixels tile by tile, the order of its live pool,
+// and the viewer's histogram shading reads them row by row into a row major
+// texture. Both go through the row and tile spans where the layout has them.
+template <GridLayout layout>
+LayoutTimes timeLayout(const LayoutFrame& frame, int repetitions) {
+    const int width = frame.width;
+    const int height = frame.height;
+    const int tileSize = Grid2d<float, layout>::tileSize;
+    Grid2d<float, layout> grid(width, height);
+    std::vector<std::uint32_t> texture(static_cast<std::size_t>(width) *
+                                       height);
+    LayoutTimes times = {0.0, 0.0, 0};
+
+    // Smooth iteration count of a pixel as the solver computes it.
+    const double escapeRadiusSquared = 256.0 * 256.0;
+    auto solvePixel = [&](int x, int y) {
+        std::complex<double> point = pixelPoint(
+            x, y, width, height, frame.location.viewCenterReal,
+            frame.location.viewCenterImag, frame.location.viewScale);
+        Complex z(0.0, 0.0), dz(0.0, 0.0);
+        Complex c(point.real(), point.imag());
+        double magnitudeSquared = 0.0;
+        unsigned int iteration =
+            iterateOrbit<MandelbrotFormula, true, false>(
+                z, dz, c, 0, frame.iterationMaximum, escapeRadiusSquared,
+                magnitudeSquared);
+        if (magnitudeSquared <= escapeRadiusSquared) {
+            return Solver::liveValue;
+        }
+        return static_cast<float>(std::max(
+            0.0, iteration - std::log2(std::log2(magnitudeSquared))));
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+        for (int tileY = 0; tileY < height; tileY += tileSize) {
+            for (int tileX = 0; tileX < width; tileX += tileSize) {
+                int tileWidth = std::min(tileSize, width - tileX);
+                int tileHeight = std::min(tileSize, height - tileY);
+                if constexpr (layout == GridLayout::rowMajor) {
+                    for (int y = tileY; y < tileY + tileHeight; y++) {
+                        auto row = grid.row(y).subspan(tileX, tileWidth);
+                        for (int x = 0; x < tileWidth; x++) {
+                            row[x] = solvePixel(tileX + x, y);
+                        }
+                    }
+                } else if constexpr (layout == GridLayout::tiled) {
+                    std::size_t tile = (tileY / tileSize) * grid.tileColumns() +
+                                       tileX / tileSize;
+                    auto pixels = grid.tile(tile);
+                    for (int y = 0; y < tileHeight; y++) {
+                        for (int x = 0; x < tileWidth; x++) {
+                            pixels[y * tileSize + x] =
+                                solvePixel(tileX + x, tileY + y);
+                        }
+                    }
+                } else {
+                    for (int y = tileY; y < tileY + tileHeight; y++) {
+                        for (int x = tileX; x < tileX + tileWidth; x++) {
+                            grid[x, y] = solvePixel(x, y);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    times.solverSeconds = secondsSince(start) / repetitions;
+
+    // Same colours as MandelbrotApplication::shadeFrame.
+    Shading shading;
+    auto toArgb = [](Shading::Colour colour) -> std::uint32_t {
+        return 0xff000000u | (get<0>(colour) << 16) | (get<1>(colour) << 8) |
+               get<2>(colour);
+    };
+    const std::uint32_t background = toArgb(shading.shade(1.0, 0.0));
+    auto shadePixel = [&](float smoothIterationCount) {
+        if (smoothIterationCount < 0.0f) {
+            return background;
+        }
+        return toArgb(shading.shade(
+            frame.escapeHistogram.fraction(smoothIterationCount + 4.0), 0.0));
+    };
+
+    start = std::chrono::steady_clock::now();
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+        for (int y = 0; y < height; y++) {
+            std::uint32_t* textureRow =
+                texture.data() + static_cast<std::size_t>(y) * width;
+            if constexpr (layout == GridLayout::rowMajor) {
+                auto row = grid.row(y);
+                for (int x = 0; x < width; x++) {
+                    textureRow[x] = shadePixel(row[x]);
+                }
+            } else if constexpr (layout == GridLayout::tiled) {
+                // Each row of a tile is contiguous.
+                for (int tileX = 0; tileX < width; tileX += tileSize) {
+                    std::size_t tile = (y / tileSize) * grid.tileColumns() +
+                                       tileX / tileSize;
+                    auto row = grid.tile(tile).subspan(
+                        (y % tileSize) * tileSize, tileSize);
+                    for (int x = 0; x < std::min(tileSize, width - tileX);
+                         x++) {
+                        textureRow[tileX + x] = shadePixel(row[x]);
+                    }
+                }
+            } else {
+                for (int x = 0; x < width; x++) {
+                    textureRow[x] = shadePixel(grid[x, y]);
+                }
+            }
+        }
+    }
+    times.drawSeconds = secondsSince(start) / repetitions;
+    times.checksum = std::accumulate(texture.begin(), texture.end(), 0u);
+
+    return times;
+}
+
+#ifdef MANDELBROT_SOCKETS
+// Minimal keep-alive HTTP client for the tile server. Returns the status code,
+// or -1 if the connection failed.
+int httpGet(int socket, const std::string& path, std::string& buffer,
+            std::string& body) {
+    std::string request =
+        "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (send(socket, request.data(), request.size(), 0) !=
+        static_cast<ssize_t>(request.size())) {
+        return -1;
+    }
+
+    char received[65536];
+    auto receive = [&]() {
+        ssize_t length = recv(socket, received, sizeof(received), 0);
+        if (length > 0) {
+            buffer.append(received, length);
+        }
+        return length > 0;
+    };
+
+    std::size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (!receive()) {
+            return -1;
+        }
+    }
+    std::string header = buffer.substr(0, headerEnd);
+    buffer.erase(0, headerEnd + 4);
+
+    std::size_t lengthStart = header.find("Content-Length: ");
+    std::size_t contentLength =
+        lengthStart == std::string::npos
+            ? 0
+            : std::stoul(header.substr(lengthStart + 16));
+    while (buffer.size() < contentLength) {
+        if (!receive()) {
+            return -1;
+        }
+    }
+    body.assign(buffer, 0, contentLength);
+    buffer.erase(0, contentLength);
+
+    return std::stoi(header.substr(header.find(' ') + 1));
+}
+
+int connectTo(int port) {
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (client >= 0 and connect(client, reinterpret_cast<sockaddr*>(&address),
+                                sizeof(address)) != 0) {
+        close(client);
+        client = -1;
+    }
+    return client;
+}
+#endif
+
+} // namespace
+
+Benchmark::Benchmark() {
+    width = 320;
+    height = 180;
+    iterationMaximum = 1024;
+}
+
+int Benchmark::run(const std::vector<std::string_view>& names) {
+    bool all = names.empty();
+    bool passed = true;
+    bool found = all;
+
+    auto selected = [&](std::string_view name) {
+        for (auto selectedName : names) {
+            if (selectedName == name) {
+                found = true;
+                return true;
+            }
+        }
+        return all;
+    };
+
+    if (selected("kernels")) {
+        passed = benchmarkKernels() and passed;
+    }
+
+    if (selected("symmetry")) {
+        passed = benchmarkSymmetry() and passed;
+    }
+
+    if (selected("scaling")) {
+        passed = benchmarkScaling() and passed;
+    }
+
+    if (selected("foveation")) {
+        passed = benchmarkFoveation() and passed;
+    }
+
+    if (selected("tiles")) {
+        passed = benchmarkTiles() and passed;
+    }
+
+    if (selected("layouts")) {
+        passed = benchmarkLayouts() and passed;
+    }
+
+    if (selected("preview")) {
+        passed = benchmarkPreview() and passed;
+    }
+
+    if (selected("density")) {
+        passed = benchmarkDensity() and passed;
+    }
+
+    if (selected("idle")) {
+        passed = benchmarkIdle() and passed;
+    }
+
+    if (selected("distance")) {
+        passed = benchmarkDistance() and passed;
+    }
+
+    if (selected("histogram")) {
+        passed = benchmarkHistogram() and passed;
+    }
+
+    if (selected("batch")) {
+        passed = benchmarkBatch() and passed;
+    }
+
+    if (selected("points")) {
+        passed = benchmarkPoints() and passed;
+    }
+
+    if (selected("recolour")) {
+        passed = benchmarkRecolour() and passed;
+    }
+
+    if (!found) {
+        std::cerr << "unknown benchmark, available: kernels, symmetry, "
+                     "scaling, foveation, tiles, layouts, preview, density, "
+                     "idle, distance, histogram, batch, points, recolour\n";
+        return EXIT_FAILURE;
+    }
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool Benchmark::benchmarkKernels() {
+    std::cout << "kernels: " << width << "x" << height << ", "
+              << iterationMaximum << " iterations\n";
+
+    // Julia mode is entered by toggling from this point, which becomes the
+    // constant while the view is centred on the origin.
+    const double juliaConstantReal = -0.8;
+    const double juliaConstantImag = 0.156;
+
+    bool passed = true;
+
+    for (int formulaIndex = 0; formulaIndex < formulaCount; formulaIndex++) {
+        Formula formula = static_cast<Formula>(formulaIndex);
+
+        for (bool mandelbrotMode : {true, false}) {
+            Solver solver;
+            solver.setVerbose(false);
+            solver.setMaxIterationCount(iterationMaximum);
+            solver.setFormula(formula);
+            if (mandelbrotMode) {
+                solver.initializeGrid(width, height, -0.5, 0.0, 1.0);
+            } else {
+                solver.initializeGrid(width, height, juliaConstantReal,
+                                      juliaConstantImag, 1.0);
+                solver.toggleJulia();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            solver.solve();
+            double seconds = secondsSince(start);
+
+            Solver::FrameData frameData;
+            solver.getFrameData(frameData);
+
+            std::vector<int> reference =
+                mandelbrotMode
+                    ? referenceHistogram(formula, true, -0.5, 0.0, 1.0, 0.0,
+                                         0.0)
+                    : referenceHistogram(formula, false, 0.0, 0.0, 1.0,
+                                         juliaConstantReal, juliaConstantImag);
+
+            // Allow for floating point contraction differences if built with
+            // -march=native, which can change escapes of chaotic orbits.
+            // Every iteration has its own histogram bin at this maximum.
+            const auto& cumulativeCounts =
+                frameData.escapeHistogram.cumulativeCounts;
+            long mismatches = 0;
+            double iterations = 0.0;
+            int previousSum = 0;
+            for (int i = 0; i < iterationMaximum; i++) {
+                int sum = static_cast<int>(cumulativeCounts[i]);
+                int count = sum - previousSum;
+                previousSum = sum;
+                mismatches += std::abs(count - reference[i]);
+                iterations += static_cast<double>(i + 1) * count;
+            }
+            iterations += static_cast<double>(width * height -
+                                              frameData.escapeCount) *
+                          iterationMaximum;
+            double mismatchRate =
+                static_cast<double>(mismatches) / (2.0 * width * height);
+            bool formulaPassed = mismatchRate < 0.001;
+            passed = passed and formulaPassed;
+
+            std::cout << std::fixed << std::setprecision(3) << "  "
+                      << std::left << std::setw(14) << formulaName(formula)
+                      << std::setw(11)
+                      << (mandelbrotMode ? "mandelbrot" : "julia")
+                      << std::right << std::setw(9) << seconds << " s "
+                      << std::setw(9) << iterations / seconds * 1e-6
+                      << " Miter/s  mismatch " << mismatchRate * 100.0
+                      << "% " << (formulaPassed ? "ok" : "FAILED") << "\n";
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    }
+
+    return passed;
+}
+
+bool Benchmark::benchmarkSymmetry() {
+    std::cout << "symmetry: " << width << "x" << height << ", "
+              << iterationMaximum << " iterations, view (-0.5, 0, 1)\n";
+
+    double seconds[2];
+    Solver::FrameData frameData[2];
+
+    for (int enabled = 0; enabled < 2; enabled++) {
+        Solver solver;
+        solver.setVerbose(false);
+        solver.setMaxIterationCount(iterationMaximum);
+        solver.setSymmetryEnabled(enabled);
+        solver.initializeGrid(width, height, -0.5, 0.0, 1.0);
+
+        auto start = std::chrono::steady_clock::now();
+        solver.solve();
+        seconds[enabled] = secondsSince(start);
+
+        solver.getFrameData(frameData[enabled]);
+    }
+
+    // Mirrored points are rounded slightly differently from directly mapped
+    // ones, which can change the escape of orbits right on the boundary.
+    const auto& withoutSymmetry = frameData[0].smoothIterationGrid;
+    const auto& withSymmetry = frameData[1].smoothIterationGrid;
+    long mismatches = 0;
+    for (std::size_t i = 0; i < withoutSymmetry.size(); i++) {
+        if (std::abs(withoutSymmetry[i] - withSymmetry[i]) > 1e-3f) {
+            mismatches++;
+        }
+    }
+    double mismatchRate =
+        static_cast<double>(mismatches) / withoutSymmetry.size();
+    bool passed = mismatchRate < 0.001;
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "  without symmetry " << seconds[0] << " s\n"
+              << "  with symmetry    " << seconds[1] << " s\n"
+              << "  speedup " << seconds[0] / seconds[1] << "x  mismatch "
+              << mismatchRate * 100.0 << "% " << (passed ? "ok" : "FAILED")
+              << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    return passed;
+}
+
+bool Benchmark::benchmarkScaling() {
+    ThreadConfig config = ThreadConfig::current();
+    unsigned int maximumThreadCount = config.threadCount();
+
+    std::cout << "scaling: " << width << "x" << height << ", "
+              << iterationMaximum << " iterations, up to "
+              << config.describe() << "\n";
+
+    for (const Location& location : testLocations) {
+        std::cout << std::setprecision(12) << "  " << location.name << " ("
+                  << location.viewCenterReal
+                  << ", " << location.viewCenterImag << ", "
+                  << location.viewScale << ")\n";
+
+        double singleThreadSeconds = 0.0;
+        for (unsigned int threadCount = 1; threadCount <= maximumThreadCount;
+             threadCount++) {
+            config.setThreadCount(threadCount);
+
+            Solver solver;
+            solver.setVerbose(false);
+            solver.setThreadConfig(config);
+            solver.setMaxIterationCount(iterationMaximum);
+            solver.initializeGrid(width, height, location.viewCenterReal,
+                                  location.viewCenterImag,
+                                  location.viewScale);
+
+            auto start = std::chrono::steady_clock::now();
+            solver.solve();
+            double seconds = secondsSince(start);
+
+            if (threadCount == 1) {
+                singleThreadSeconds = seconds;
+            }
+            double speedup = singleThreadSeconds / seconds;
+
+            std::cout << std::fixed << std::setprecision(3) << "    "
+                      << std::setw(3) << threadCount << " threads "
+                      << std::setw(9) << seconds << " s  speedup "
+                      << std::setw(7) << speedup << "x  efficiency "
+                      << std::setw(6) << speedup / threadCount * 100.0
+                      << "%\n";
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    }
+
+    return true;
+}
+
+bool Benchmark::benchmarkFoveation() {
+    const int foveationWidth = 1280;
+    const int foveationHeight = 720;
+    const Location& location = testLocations[2];
+    const int focusX = foveationWidth * 3 / 4;
+    const int focusY = foveationHeight / 2;
+    const int regionRadius = 64;
+
+    std::cout << "foveation: " << foveationWidth << "x" << foveationHeight
+              << ", " << iterationMaximum << " iterations, " << location.name
+              << ", focus (" << focusX << ", " << focusY << ")\n";
+
+    auto newSolver = [&]() {
+        auto solver = std::make_unique<Solver>();
+        solver->setVerbose(false);
+        solver->setMaxIterationCount(iterationMaximum);
+        solver->initializeGrid(foveationWidth, foveationHeight,
+                               location.viewCenterReal,
+                               location.viewCenterImag, location.viewScale);
+        solver->setFocus(focusX, focusY);
+        return solver;
+    };
+
+    Solver::FrameData finalFrame;
+    {
+        auto solver = newSolver();
+        auto start = std::chrono::steady_clock::now();
+        solver->solve();
+        double seconds = secondsSince(start);
+        solver->getFrameData(finalFrame);
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "  solve without display " << seconds << " s\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    const Grid2d<float>& finalGrid = finalFrame.smoothIterationGrid;
+    auto matches = [&](const Grid2d<float>& grid, int left, int top,
+                       int right, int bottom) {
+        left = std::max(left, 0);
+        right = std::min(right, foveationWidth);
+        for (int y = std::max(top, 0); y < std::min(bottom, foveationHeight);
+             y++) {
+            auto row = grid.row(y).subspan(left, right - left);
+            auto finalRow = finalGrid.row(y).subspan(left, right - left);
+            for (std::size_t x = 0; x < row.size(); x++) {
+                if (std::abs(row[x] - finalRow[x]) > 1e-3f) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    for (Solver::Scheduling scheduling :
+         {Solver::Scheduling::uniform, Solver::Scheduling::foveated}) {
+        auto solver = newSolver();
+        solver->setScheduling(scheduling);
+
+        auto start = std::chrono::steady_clock::now();
+        std::jthread solverThread(&Solver::calculationLoop, solver.get());
+
+        double regionSeconds = -1.0;
+        double frameSeconds = -1.0;
+        Solver::FrameData frameData;
+        while (frameSeconds < 0.0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            solver->getFrameData(frameData);
+            if (regionSeconds < 0.0 and
+                matches(frameData.smoothIterationGrid, focusX - regionRadius,
+                        focusY - regionRadius, focusX + regionRadius,
+                        focusY + regionRadius)) {
+                regionSeconds = secondsSince(start);
+            }
+            if (frameData.escapeCount == finalFrame.escapeCount and
+                matches(frameData.smoothIterationGrid, 0, 0, foveationWidth,
+                        foveationHeight)) {
+                frameSeconds = secondsSince(start);
+            }
+        }
+        solver->stop();
+
+        std::cout << std::fixed << std::setprecision(3) << "  " << std::left
+                  << std::setw(9)
+                  << (scheduling == Solver::Scheduling::uniform ? "uniform"
+                                                                : "foveated")
+                  << std::right << " focus region " << std::setw(7)
+                  << regionSeconds << " s  full frame " << std::setw(7)
+                  << frameSeconds << " s\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    return true;
+}
+
+bool Benchmark::benchmarkTiles() {
+#ifdef MANDELBROT_SOCKETS
+    const unsigned int workerCount = ThreadConfig::current().threadCount();
+    const unsigned int clientCount = std::max(2 * workerCount, 4u);
+    const int requestsPerClient = 100;
+    const std::size_t cacheCapacity = 64;
+
+    // Tiles of the mandelbrot set and a julia set at a few zoom levels,
+    // requested with zipf-like popularity, more than fit in the cache.
+    std::vector<std::string> paths;
+    for (std::string constant : {"m", "-0.8,0.156"}) {
+        for (int zoom = 1; zoom <= 3; zoom++) {
+            for (int y = 0; y < (1 << zoom); y++) {
+                for (int x = 0; x < (1 << zoom); x++) {
+                    paths.push_back("/mandelbrot/" + constant + "/" +
+                                    std::to_string(zoom) + "/" +
+                                    std::to_string(x) + "/" +
+                                    std::to_string(y) + ".png");
+                }
+            }
+        }
+    }
+    std::vector<double> weights;
+    for (std::size_t rank = 0; rank < paths.size(); rank++) {
+        weights.push_back(1.0 / (rank + 1));
+    }
+
+    std::cout << "tiles: " << workerCount << " workers, " << clientCount
+              << " clients, " << requestsPerClient << " requests each, "
+              << paths.size() << " tiles, cache of " << cacheCapacity << ", "
+              << iterationMaximum << " iterations\n";
+
+    TileServer server(workerCount, cacheCapacity, iterationMaximum);
+    int port = server.listen(0);
+    std::jthread serverThread(&TileServer::serve, &server);
+
+    std::vector<std::vector<double>> latencies(clientCount);
+    std::atomic_int failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> clients;
+        for (unsigned int client = 0; client < clientCount; client++) {
+            clients.emplace_back([&, client] {
+                int socket = connectTo(port);
+                if (socket < 0) {
+                    failures += requestsPerClient;
+                    return;
+                }
+                std::mt19937 random(client);
+                std::discrete_distribution<std::size_t> pick(weights.begin(),
+                                                             weights.end());
+                std::string buffer, body;
+                for (int i = 0; i < requestsPerClient; i++) {
+                    // Every client starts on the same tile, which should only
+                    // be rendered once.
+                    const std::string& path = paths[i == 0 ? 0 : pick(random)];
+                    auto requestStart = std::chrono::steady_clock::now();
+                    int status = httpGet(socket, path, buffer, body);
+                    latencies[client].push_back(secondsSince(requestStart));
+                    if (status != 200 or body.compare(1, 3, "PNG") != 0) {
+                        failures++;
+                    }
+                }
+                close(socket);
+            });
+        }
+    }
+    double seconds = secondsSince(start);
+
+    std::string body, buffer;
+    int socket = connectTo(port);
+    bool rawPassed =
+        httpGet(socket, "/mandelbrot/m/0/0/0.raw", buffer, body) == 200 and
+        body.size() ==
+            TileServer::tileSize * TileServer::tileSize * sizeof(float);
+    bool missingPassed = httpGet(socket, "/nothing/here", buffer, body) == 404;
+    close(socket);
+
+    server.stop();
+
+    std::vector<double> allLatencies;
+    for (const auto& clientLatencies : latencies) {
+        allLatencies.insert(allLatencies.end(), clientLatencies.begin(),
+                            clientLatencies.end());
+    }
+    std::sort(allLatencies.begin(), allLatencies.end());
+    auto percentile = [&allLatencies](double fraction) {
+        return allLatencies[std::min<std::size_t>(
+                   fraction * allLatencies.size(), allLatencies.size() - 1)] *
+               1000.0;
+    };
+
+    TileServer::Statistics statistics = server.statistics();
+    unsigned long requestCount = clientCount * requestsPerClient + 1;
+    // Every tile request is a hit, a render or waits for a render.
+    bool passed = failures == 0 and rawPassed and missingPassed and
+                  statistics.hits + statistics.renders +
+                          statistics.deduplicated ==
+                      requestCount;
+
+    std::cout << std::fixed << std::setprecision(3) << "  " << seconds
+              << " s  " << allLatencies.size() / seconds << " tiles/s\n"
+              << "  latency p50 " << percentile(0.5) << " ms  p99 "
+              << percentile(0.99) << " ms  max " << allLatencies.back() * 1000.0
+              << " ms\n"
+              << "  cache hits " << statistics.hits << "  renders "
+              << statistics.renders << "  deduplicated "
+              << statistics.deduplicated << "  "
+              << (passed ? "ok" : "FAILED") << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    return passed;
+#else
+    std::cout << "tiles: not supported on this platform\n";
+    return true;
+#endif
+}
+
+bool Benchmark::benchmarkLayouts() {
+    const int layoutWidth = 1920;
+    const int layoutHeight = 1080;
+    const int repetitions = 3;
+    const double megapixels = layoutWidth * layoutHeight / 1e6;
+
+    LayoutFrame frame = {.width = layoutWidth,
+                         .height = layoutHeight,
+                         .iterationMaximum = 64,
+                         .location = testLocations[0],
+                         .escapeHistogram = {}};
+    std::cout << "layouts: " << layoutWidth << "x" << layoutHeight << ", "
+              << frame.iterationMaximum << " iterations, "
+              << frame.location.name
+              << ", solver kernel writes tile by tile, shading reads row by "
+                 "row\n";
+
+    // The escape histogram of the frame, for shading.
+    {
+        Solver solver;
+        solver.setVerbose(false);
+        solver.setMaxIterationCount(frame.iterationMaximum);
+        solver.initializeGrid(layoutWidth, layoutHeight,
+                              frame.location.viewCenterReal,
+                              frame.location.viewCenterImag,
+                              frame.location.viewScale);
+        solver.solve();
+        Solver::FrameData frameData;
+        solver.getFrameData(frameData);
+        frame.escapeHistogram = frameData.escapeHistogram;
+    }
+
+    auto print = [&](std::string_view name, const LayoutTimes& times) {
+        std::cout << std::fixed << std::setprecision(3) << "  " << std::left
+                  << std::setw(10) << name << std::right << " solver "
+                  << std::setw(8) << times.solverSeconds * 1000.0 << " ms "
+                  << std::setw(7) << megapixels / times.solverSeconds
+                  << " Mpixels/s  shading " << std::setw(7)
+                  << times.drawSeconds * 1000.0 << " ms " << std::setw(7)
+                  << megapixels / times.drawSeconds << " Mpixels/s\n";
+        std::cout.unsetf(std::ios::floatfield);
+    };
+    LayoutTimes rowMajor =
+        timeLayout<GridLayout::rowMajor>(frame, repetitions);
+    LayoutTimes tiled = timeLayout<GridLayout::tiled>(frame, repetitions);
+    LayoutTimes morton = timeLayout<GridLayout::morton>(frame, repetitions);
+    print("row major", rowMajor);
+    print("tiled", tiled);
+    print("morton", morton);
+    // Every layout holds the same image.
+    bool passed = rowMajor.checksum == tiled.checksum and
+                  rowMajor.checksum == morton.checksum;
+
+    // A freshly sized grid is filled once either way, without initialisation
+    // that is the only pass over it.
+    double uninitialisedSeconds = 0.0;
+    double initialisedSeconds = 0.0;
+    float checksum = 0.0f;
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+        auto start = std::chrono::steady_clock::now();
+        Grid2d<float> grid(layoutWidth, layoutHeight);
+        grid.fill(Solver::liveValue);
+        uninitialisedSeconds += secondsSince(start);
+        checksum += grid[repetition];
+
+        start = std::chrono::steady_clock::now();
+        std::vector<float> vector(layoutWidth * layoutHeight);
+        std::fill(vector.begin(), vector.end(), Solver::liveValue);
+        initialisedSeconds += secondsSince(start);
+        checksum += vector[repetition];
+    }
+    std::cout << std::fixed << std::setprecision(3)
+              << "  resize and fill: uninitialised "
+              << uninitialisedSeconds / repetitions * 1000.0
+              << " ms, value initialised "
+              << initialisedSeconds / repetitions * 1000.0 << " ms\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    std::cout << "  " << (passed ? "ok" : "layouts differ") << "\n";
+    return passed and checksum != 0.0f;
+}
+
+bool Benchmark::benchmarkPreview() {
+    const int previewSize = 192;
+    const int previewIterationMaximum = 256;
+    const auto frameInterval = std::chrono::microseconds(16667);
+    const auto budget = frameInterval / 4;
+    const int mainWidth = 2 * width;
+    const int mainHeight = 2 * height;
+    const Location& location = testLocations[2];
+
+    std::cout << "preview: " << previewSize << "x" << previewSize << ", "
+              << previewIterationMaximum << " iterations, "
+              << budget.count() << " us per " << frameInterval.count()
+              << " us frame, main render " << mainWidth << "x" << mainHeight
+              << " " << location.name << ", " << iterationMaximum
+              << " iterations\n";
+
+    // A mouse circling the main cardioid, in and out of the set.
+    auto pointOnPath = [](int step) {
+        double angle = step * 0.05;
+        return Complex(-0.4 + 0.7 * std::cos(angle), 0.7 * std::sin(angle));
+    };
+
+    auto report = [](std::string_view name, std::vector<double> latencies,
+                     int requests) {
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << std::fixed << std::setprecision(2) << "  " << name << " "
+                  << latencies.size() << " of " << requests
+                  << " previews completed";
+        if (!latencies.empty()) {
+            std::cout << ", latency median "
+                      << latencies[latencies.size() / 2] << " ms  p99 "
+                      << latencies[(latencies.size() - 1) * 99 / 100]
+                      << " ms  max " << latencies.back() << " ms";
+        }
+        std::cout << "\n";
+        std::cout.unsetf(std::ios::floatfield);
+    };
+
+    bool passed = true;
+
+    // Idle: each preview is waited for before the next request.
+    const int idleRequests = 20;
+    {
+        JuliaPreview preview(previewSize, previewIterationMaximum, budget,
+                             frameInterval, nullptr);
+        JuliaPreview::Frame frame;
+        for (int step = 0; step < idleRequests; step++) {
+            preview.request(Formula::mandelbrot, pointOnPath(step * 8));
+            auto start = std::chrono::steady_clock::now();
+            do {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (secondsSince(start) > 5.0) {
+                    std::cout << "  FAILED: preview didn't complete\n";
+                    return false;
+                }
+            } while (!preview.takeFrame(frame) or !frame.isComplete);
+
+            if (frame.size != previewSize or
+                frame.pixels.size() !=
+                    static_cast<std::size_t>(previewSize * previewSize)) {
+                passed = false;
+            }
+        }
+        report("idle:      ", preview.latencies(), idleRequests);
+    }
+
+    auto renderMain = [&] {
+        Solver solver;
+        solver.setVerbose(false);
+        solver.setMaxIterationCount(iterationMaximum);
+        solver.initializeGrid(mainWidth, mainHeight, location.viewCenterReal,
+                              location.viewCenterImag, location.viewScale);
+        auto start = std::chrono::steady_clock::now();
+        solver.solve();
+        return secondsSince(start);
+    };
+
+    double baselineSeconds = renderMain();
+
+    // Moving: a new request every frame while the main solver renders.
+    int movingRequests = 0;
+    double loadedSeconds;
+    std::vector<double> movingLatencies;
+    {
+        JuliaPreview preview(previewSize, previewIterationMaximum, budget,
+                             frameInterval, nullptr);
+        std::jthread mouse([&](std::stop_token stopToken) {
+            auto next = std::chrono::steady_clock::now();
+            while (!stopToken.stop_requested()) {
+                preview.request(Formula::mandelbrot,
+                                pointOnPath(movingRequests++));
+                next += frameInterval;
+                std::this_thread::sleep_until(next);
+            }
+        });
+        loadedSeconds = renderMain();
+        mouse.request_stop();
+        mouse.join();
+        movingLatencies = preview.latencies();
+    }
+    report("moving:    ", movingLatencies, movingRequests);
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "  main render alone " << baselineSeconds
+              << " s, with previews " << loadedSeconds << " s ("
+              << std::setprecision(1)
+              << (loadedSeconds / baselineSeconds - 1.0) * 100.0
+              << "% slower), "
+              << std::thread::hardware_concurrency() << " hardware threads\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    if (!passed) {
+        std::cout << "  FAILED: preview frames have the wrong size\n";
+    }
+    return passed;
+}
+
+bool Benchmark::benchmarkDensity() {
+    const int densityWidth = width / 2;
+    const int densityHeight = height / 2;
+    ThreadConfig config = ThreadConfig::current();
+    unsigned int maximumThreadCount = config.threadCount();
+
+    std::cout << "density: " << densityWidth << "x" << densityHeight << ", "
+              << iterationMaximum << " iterations, up to "
+              << config.describe() << "\n";
+
+    bool passed = true;
+    for (auto renderMode : {Solver::RenderMode::buddhabrot,
+                            Solver::RenderMode::antiBuddhabrot}) {
+        std::cout << "  "
+                  << (renderMode == Solver::RenderMode::buddhabrot
+                          ? "buddhabrot"
+                          : "anti-buddhabrot")
+                  << "\n";
+
+        Solver::FrameData frameData, reference;
+        double singleThreadRate = 0.0;
+        for (unsigned int threadCount = 1; threadCount <= maximumThreadCount;
+             threadCount++) {
+            config.setThreadCount(threadCount);
+
+            Solver solver;
+            solver.setVerbose(false);
+            solver.setThreadConfig(config);
+            solver.setMaxIterationCount(iterationMaximum);
+            solver.setRenderMode(renderMode);
+            solver.initializeGrid(densityWidth, densityHeight, -0.5, 0.0, 1.0);
+
+            auto start = std::chrono::steady_clock::now();
+            solver.solve();
+            double seconds = secondsSince(start);
+            solver.getFrameData(frameData);
+
+            double rate = frameData.sampleCount / seconds;
+            if (threadCount == 1) {
+                singleThreadRate = rate;
+                reference = frameData;
+            }
+
+            // Tasks only depend on the thread count past 16 threads.
+            bool matches = true;
+            if (threadCount <= 16) {
+                for (int channel = 0; channel < 3; channel++) {
+                    auto counts = frameData.densityGrids[channel].elements();
+                    auto expected = reference.densityGrids[channel].elements();
+                    matches = matches and
+                              std::ranges::equal(counts, expected) and
+                              frameData.densityMaxima[channel] > 0;
+                }
+            }
+            passed = passed and matches;
+
+            std::cout << std::fixed << std::setprecision(3) << "    "
+                      << std::setw(3) << threadCount << " threads "
+                      << std::setw(9) << seconds << " s "
+                      << std::setprecision(2) << std::setw(8) << rate * 1e-6
+                      << " M samples/s  speedup " << std::setw(6)
+                      << rate / singleThreadRate << "x  "
+                      << (matches ? "ok" : "MISMATCH") << "\n";
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    }
+
+    if (!passed) {
+        std::cout << "  FAILED: images differ between thread counts or are "
+                     "empty\n";
+    }
+    return passed;
+}
+
+bool Benchmark::benchmarkIdle() {
+    const auto idleDuration = std::chrono::seconds(1);
+
+    std::cout << "idle: " << width << "x" << height << ", "
+              << iterationMaximum << " iterations, solver loop\n";
+
+    Solver solver;
+    solver.setVerbose(false);
+    solver.setMaxIterationCount(iterationMaximum);
+    solver.initializeGrid(width, height, -0.5, 0.0, 1.0);
+
+    std::atomic_ulong frameCount = 0;
+    solver.setFrameCallback([&frameCount] { frameCount++; });
+    std::jthread solverThread(&Solver::calculationLoop, &solver);
+
+    // Converged once no frame arrives for a while.
+    auto waitForConvergence = [&frameCount] {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long seenCount = frameCount;
+        auto lastFrame = start;
+        while (std::chrono::steady_clock::now() - lastFrame <
+               std::chrono::milliseconds(200)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (frameCount != seenCount) {
+                seenCount = frameCount;
+                lastFrame = std::chrono::steady_clock::now();
+            }
+        }
+        return std::chrono::duration<double>(lastFrame - start).count();
+    };
+
+    double convergenceSeconds = waitForConvergence();
+
+    unsigned long idleFrames = frameCount;
+    double cpuStart = processCpuSeconds();
+    std::this_thread::sleep_for(idleDuration);
+    double idleCpu = (processCpuSeconds() - cpuStart) /
+                     std::chrono::duration<double>(idleDuration).count();
+    idleFrames = frameCount - idleFrames;
+
+    // A frame copy while idle returns straight away.
+    Solver::FrameData frameData;
+    auto copyStart = std::chrono::steady_clock::now();
+    solver.getFrameData(frameData);
+    double copySeconds = secondsSince(copyStart);
+
+    unsigned long framesBeforeZoom = frameCount;
+    solver.zoomIn(2.0);
+    double reconvergenceSeconds = waitForConvergence();
+    bool woke = frameCount > framesBeforeZoom;
+
+    solver.stop();
+    solverThread.join();
+
+    bool passed = idleCpu < 0.05 and idleFrames == 0 and woke;
+
+    std::cout << std::fixed << std::setprecision(3) << "  converged after "
+              << convergenceSeconds << " s, " << frameData.iterationCount
+              << " passes\n"
+              << std::setprecision(2) << "  idle CPU " << idleCpu * 100.0
+              << "% of a core over "
+              << std::chrono::duration<double>(idleDuration).count()
+              << " s, " << idleFrames << " frames\n"
+              << std::setprecision(3) << "  frame copy while idle "
+              << copySeconds * 1000.0 << " ms\n"
+              << "  zoom " << (woke ? "woke" : "didn't wake")
+              << " the solver, reconverged after " << reconvergenceSeconds
+              << " s  " << (passed ? "ok" : "FAILED") << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    return passed;
+}
+
+bool Benchmark::benchmarkDistance() {
+    // Matches the solver's refinement.
+    const int refinementIterationFactor = 4;
+
+    std::cout << "distance: " << width << "x" << height << ", "
+              << iterationMaximum << " iterations, refinement up to "
+              << iterationMaximum * refinementIterationFactor << "\n";
+
+    bool passed = true;
+    for (const Location& location : testLocations) {
+        auto render = [&location](int renderWidth, int renderHeight,
+                                  int renderIterationMaximum,
+                                  bool distanceEstimation,
+                                  Solver::FrameData& frameData) {
+            Solver solver;
+            solver.setVerbose(false);
+            solver.setMaxIterationCount(renderIterationMaximum);
+            solver.setDistanceEstimation(distanceEstimation);
+            solver.initializeGrid(renderWidth, renderHeight,
+                                  location.viewCenterReal,
+                                  location.viewCenterImag, location.viewScale);
+
+            auto start = std::chrono::steady_clock::now();
+            solver.solve();
+            double seconds = secondsSince(start);
+            solver.getFrameData(frameData);
+            return seconds;
+        };
+
+        Solver::FrameData plain, refined, supersampled;
+        double plainSeconds =
+            render(width, height, iterationMaximum, false, plain);
+        double refinedSeconds =
+            render(width, height, iterationMaximum, true, refined);
+        double supersampledSeconds =
+            render(2 * width, 2 * height,
+                   iterationMaximum * refinementIterationFactor, false,
+                   supersampled);
+
+        // Refinement may let more pixels escape but never fewer, and every
+        // escaped pixel has a distance estimate.
+        long lostEscapes = 0;
+        long missingDistances = 0;
+        for (std::size_t i = 0; i < plain.smoothIterationGrid.size(); i++) {
+            if (plain.smoothIterationGrid[i] >= 0.0f and
+                refined.smoothIterationGrid[i] < 0.0f) {
+                lostEscapes++;
+            }
+            if (refined.smoothIterationGrid[i] >= 0.0f and
+                !(refined.distanceGrid[i] >= 0.0f)) {
+                missingDistances++;
+            }
+        }
+        bool locationPassed = lostEscapes == 0 and missingDistances == 0;
+        passed = passed and locationPassed;
+
+        double pixelCount = static_cast<double>(width) * height;
+        std::cout << std::fixed << std::setprecision(3) << "  " << std::left
+                  << std::setw(16) << location.name << std::right
+                  << "plain " << plainSeconds << " s, refined "
+                  << refinedSeconds << " s, uniform 2x2 "
+                  << supersampledSeconds << " s\n"
+                  << std::setprecision(2) << "    "
+                  << std::setw(16) << ""
+                  << "refinement samples "
+                  << refined.refinementSampleCount / pixelCount * 100.0
+                  << "% of pixels vs 400%, late escapes "
+                  << refined.escapeCount - plain.escapeCount << "  "
+                  << (locationPassed ? "ok" : "FAILED") << "\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    return passed;
+}
+
+bool Benchmark::benchmarkHistogram() {
+    // The default view's escapes stretched over a deep iteration range, which
+    // arrive over a number of frames as the render progresses.
+    const unsigned int deepIterationMaximum = 1 << 20;
+    const int frameCount = 64;
+
+    std::cout << "histogram: " << width << "x" << height << ", "
+              << deepIterationMaximum << " iterations, " << frameCount
+              << " frames\n";
+
+    Solver solver;
+    solver.setVerbose(false);
+    solver.setMaxIterationCount(iterationMaximum);
+    solver.initializeGrid(width, height, -0.5, 0.0, 1.0);
+    solver.solve();
+    Solver::FrameData frameData;
+    solver.getFrameData(frameData);
+
+    const double stretch =
+        static_cast<double>(deepIterationMaximum) / iterationMaximum;
+    std::vector<double> escapes;
+    for (float value : frameData.smoothIterationGrid.elements()) {
+        if (value >= 0.0f) {
+            escapes.push_back(value * stretch);
+        }
+    }
+    std::ranges::sort(escapes);
+    auto iterationOf = [deepIterationMaximum](double value) {
+        return std::clamp(static_cast<unsigned int>(value) + 1, 1u,
+                          deepIterationMaximum);
+    };
+
+    // Prefix sums over every iteration, interpolated like histogram colouring
+    // used to, one frame with new escapes up to escapedCount.
+    std::vector<int> counts(deepIterationMaximum, 0);
+    std::vector<int> sums(deepIterationMaximum);
+    std::vector<float> prefixFactors(escapes.size());
+    auto prefixSumFrame = [&](std::size_t escapedCount) {
+        auto start = std::chrono::steady_clock::now();
+        std::partial_sum(counts.begin(), counts.end(), sums.begin());
+        for (std::size_t i = 0; i < escapedCount; i++) {
+            double x = escapes[i] + 4.0;
+            int a = std::max(static_cast<int>(std::floor(x)), 0);
+            int b = std::min(static_cast<int>(std::ceil(x)),
+                             static_cast<int>(sums.size()) - 1);
+            double sum = sums[std::min(a, static_cast<int>(sums.size()) - 1)];
+            if (b > a) {
+                sum = sums[a] + (x - a) * (sums[b] - sums[a]);
+            }
+            prefixFactors[i] = sum / static_cast<double>(escapedCount);
+        }
+        return secondsSince(start);
+    };
+
+    EscapeHistogram histogram;
+    histogram.reset(deepIterationMaximum);
+    EscapeHistogram::Table table;
+    std::vector<float> tableFactors(escapes.size());
+    auto tableFrame = [&](std::size_t escapedCount) {
+        auto start = std::chrono::steady_clock::now();
+        histogram.publish();
+        histogram.copyTo(table);
+        for (std::size_t i = 0; i < escapedCount; i++) {
+            tableFactors[i] = table.fraction(escapes[i] + 4.0);
+        }
+        return secondsSince(start);
+    };
+
+    double prefixSumSeconds = 0.0;
+    double tableSeconds = 0.0;
+    std::size_t escapedCount = 0;
+    for (int frame = 1; frame <= frameCount; frame++) {
+        double frameEnd =
+            static_cast<double>(deepIterationMaximum) * frame / frameCount;
+        std::size_t frameStart = escapedCount;
+        while (escapedCount < escapes.size() and
+               escapes[escapedCount] < frameEnd) {
+            escapedCount++;
+        }
+        for (std::size_t i = frameStart; i < escapedCount; i++) {
+            unsigned int iteration = iterationOf(escapes[i]);
+            counts[iteration - 1]++;
+            histogram.add(iteration, 1);
+        }
+
+        prefixSumSeconds += prefixSumFrame(escapedCount);
+        tableSeconds += tableFrame(escapedCount);
+    }
+
+    // A frame without new escapes.
+    double unchangedPrefixSumSeconds = prefixSumFrame(escapedCount);
+    unsigned long version = table.version;
+    double unchangedTableSeconds = tableFrame(escapedCount);
+    bool isCopySkipped = table.version == version;
+
+    // Bins share interpolation steps past the linear bins, which moves
+    // colours slightly within a bin.
+    float maximumDifference = 0.0f;
+    for (std::size_t i = 0; i < escapedCount; i++) {
+        maximumDifference = std::max(
+            maximumDifference, std::abs(prefixFactors[i] - tableFactors[i]));
+    }
+    bool passed = maximumDifference < 0.01f and isCopySkipped;
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "  prefix sums " << prefixSumSeconds / frameCount * 1000.0
+              << " ms/frame, " << unchangedPrefixSumSeconds * 1000.0
+              << " ms unchanged, " << deepIterationMaximum << " entries\n"
+              << "  table       " << tableSeconds / frameCount * 1000.0
+              << " ms/frame, " << unchangedTableSeconds * 1000.0
+              << " ms unchanged, " << table.cumulativeCounts.size()
+              << " bins\n"
+              << "  largest colour difference " << maximumDifference << " "
+              << (passed ? "ok" : "FAILED") << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    return passed;
+}
+
+bool Benchmark::benchmarkBatch() {
+    const int thumbnailSize = 64;
+    const int thumbnailCount = 96;
+    const int largeCount = 2;
+
+    std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / "mandelbrot-batch-benchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "batch");
+    std::filesystem::create_directories(directory / "serial");
+
+    // Thumbnails of every test location, formula and palette, and a few
+    // images large enough to be split into bands.
+    std::vector<BatchRenderer::Job> jobs;
+    for (int i = 0; i < thumbnailCount + largeCount; i++) {
+        const Location& location = testLocations[i % testLocations.size()];
+        BatchRenderer::Job job;
+        job.output = std::to_string(i) + ".png";
+        job.width = i < thumbnailCount ? thumbnailSize : width * 2;
+        job.height = i < thumbnailCount ? thumbnailSize : height * 2;
+        job.formula = static_cast<Formula>(i % formulaCount);
+        job.viewCenterReal = location.viewCenterReal;
+        job.viewCenterImag = location.viewCenterImag;
+        job.viewScale = location.viewScale;
+        job.palette = i % 4;
+        job.iterationMaximum = iterationMaximum;
+        jobs.push_back(job);
+    }
+    std::size_t pixelCount = 0;
+    for (const auto& job : jobs) {
+        pixelCount += static_cast<std::size_t>(job.width) * job.height;
+    }
+
+    ThreadConfig config = ThreadConfig::current();
+    std::cout << "batch: " << thumbnailCount << " images of "
+              << thumbnailSize << "x" << thumbnailSize << " and " << largeCount
+              << " of " << width * 2 << "x" << height * 2 << ", "
+              << iterationMaximum << " iterations, " << config.describe()
+              << "\n";
+
+    auto inDirectory = [&jobs, &directory](const char* name) {
+        std::vector<BatchRenderer::Job> located = jobs;
+        for (auto& job : located) {
+            job.output = (directory / name / job.output).string();
+        }
+        return located;
+    };
+
+    std::vector<BatchRenderer::Job> serialJobs = inDirectory("serial");
+    auto serialStart = std::chrono::steady_clock::now();
+    for (const auto& job : serialJobs) {
+        Solver solver;
+        solver.setVerbose(false);
+        solver.setMaxIterationCount(job.iterationMaximum);
+        solver.setFormula(job.formula);
+        solver.setFractal(job.mandelbrotMode, job.constantReal,
+                          job.constantImag);
+        solver.initializeGrid(job.width, job.height, job.viewCenterReal,
+                              job.viewCenterImag, job.viewScale);
+        solver.solve();
+        Solver::FrameData frameData;
+        solver.getFrameData(frameData);
+        BatchRenderer::writeImage(job, frameData.smoothIterationGrid,
+                                  frameData.escapeHistogram);
+    }
+    double serialSeconds = secondsSince(serialStart);
+
+    std::vector<BatchRenderer::Job> batchJobs = inDirectory("batch");
+    BatchRenderer renderer(config.threadCount());
+    auto batchStart = std::chrono::steady_clock::now();
+    auto reports = renderer.render(batchJobs);
+    double batchSeconds = secondsSince(batchStart);
+
+    auto readFile = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        std::string contents(file ? static_cast<std::size_t>(file.tellg()) : 0,
+                             '\0');
+        file.seekg(0);
+        file.read(contents.data(), contents.size());
+        return contents;
+    };
+    long mismatches = 0;
+    double latencySum = 0.0;
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        latencySum += reports[i].latencySeconds;
+        std::string batchImage = readFile(batchJobs[i].output);
+        bool matches =
+            reports[i].bandCount > 1 or
+            (!batchImage.empty() and
+             batchImage == readFile(serialJobs[i].output));
+        if (!reports[i].isWritten or !matches) {
+            mismatches++;
+        }
+    }
+    bool passed = mismatches == 0;
+
+    std::filesystem::remove_all(directory);
+
+    double imageCount = static_cast<double>(jobs.size());
+    std::cout << std::fixed << std::setprecision(3) << "  serial "
+              << serialSeconds << " s " << std::setprecision(1)
+              << std::setw(8) << imageCount / serialSeconds << " images/s "
+              << std::setprecision(2) << std::setw(6)
+              << pixelCount / serialSeconds * 1e-6
+              << " Mpixels/s\n"
+              << std::setprecision(3) << "  batch  " << batchSeconds << " s "
+              << std::setprecision(1) << std::setw(8)
+              << imageCount / batchSeconds << " images/s "
+              << std::setprecision(2) << std::setw(6)
+              << pixelCount / batchSeconds * 1e-6 << " Mpixels/s\n"
+              << std::setprecision(2) << "  speedup "
+              << serialSeconds / batchSeconds << "x, mean image latency "
+              << latencySum / imageCount * 1000.0 << " ms, " << mismatches
+              << " mismatched images " << (passed ? "ok" : "FAILED") << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+
+    return passed;
+}
+
+bool Benchmark::benchmarkPoints() {
+    std::cout << "points: " << width << "x" << height << " points, "
+              << iterationMaximum << " iterations, "
+              << ThreadConfig::current().threadCount() << " threads\n";
+
+    // The views of the kernels benchmark.
+    const Complex juliaConstant(-0.8, 0.156);
+
+    bool passed = true;
+
+    for (int formulaIndex = 0; formulaIndex < formulaCount; formulaIndex++) {
+        Formula formula = static_cast<Formula>(formulaIndex);
+
+        for (bool mandelbrotMode : {true, false}) {
+            double viewCenterReal = mandelbrotMode ? -0.5 : 0.0;
+            std::vector<Complex> points;
+            points.reserve(width * height);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    std::complex<double> point =
+                        pixelPoint(x, y, width, height, viewCenterReal, 0.0,
+                                   1.0);
+                    points.emplace_back(point.real(), point.imag());
+                }
+            }
+
+            PointSolver pointSolver;
+            pointSolver.setFormula(formula);
+            pointSolver.setFractal(mandelbrotMode, mandelbrotMode
+                                                       ? Complex(0.0, 0.0)
+                                                       : juliaConstant);
+            pointSolver.setMaxIterationCount(iterationMaximum);
+
+            PointSolver::Results results;
+            auto start = std::chrono::steady_clock::now();
+            pointSolver.solve(points, results);
+            double seconds = secondsSince(start);
+
+            pointSolver.setDistanceEstimation(true);
+            PointSolver::Results distanceResults;
+            start = std::chrono::steady_clock::now();
+            pointSolver.solve(points, distanceResults);
+            double distanceSeconds = secondsSince(start);
+
+            std::vector<int> reference = referenceHistogram(
+                formula, mandelbrotMode, viewCenterReal, 0.0, 1.0,
+                mandelbrotMode ? 0.0 : juliaConstant.real,
+                mandelbrotMode ? 0.0 : juliaConstant.imag);
+
+            // Mismatches allow for contraction differences as in the kernels
+            // benchmark. Distance estimation mustn't change any escape, and
+            // gives distances exactly to escaped points.
+            std::vector<int> histogram(iterationMaximum, 0);
+            double iterations = 0.0;
+            bool isConsistent = true;
+            for (std::size_t i = 0; i < points.size(); i++) {
+                unsigned int iteration = results.escapeIterations[i];
+                if (iteration > 0) {
+                    histogram[iteration - 1]++;
+                    iterations += iteration;
+                } else {
+                    iterations += iterationMaximum;
+                }
+                isConsistent =
+                    isConsistent and
+                    distanceResults.escapeIterations[i] == iteration and
+                    (distanceResults.distances[i] >= 0.0) == (iteration > 0);
+            }
+            long mismatches = 0;
+            for (int i = 0; i < iterationMaximum; i++) {
+                mismatches += std::abs(histogram[i] - reference[i]);
+            }
+            double mismatchRate =
+                static_cast<double>(mismatches) / (2.0 * width * height);
+            bool formulaPassed = mismatchRate < 0.001 and isConsistent;
+            passed = passed and formulaPassed;
+
+            std::cout << std::fixed << std::setprecision(3) << "  "
+                      << std::left << std::setw(14) << formulaName(formula)
+                      << std::setw(11)
+                      << (mandelbrotMode ? "mandelbrot" : "julia")
+                      << std::right << std::setw(9)
+                      << points.size() / seconds * 1e-6 << " Mpoints/s "
+                      << std::setw(9) << iterations / seconds * 1e-6
+                      << " Miter/s, with distances " << std::setw(9)
+                      << iterations / distanceSeconds * 1e-6
+                      << " Miter/s  mismatch " << mismatchRate * 100.0
+                      << "% " << (formulaPassed ? "ok" : "FAILED") << "\n";
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    }
+
+    return passed;
+}
+
+bool Benchmark::benchmarkRecolour() {
+    const Location& location = testLocations[2];
+    const int renderWidth = width * 2;
+    const int renderHeight = height * 2;
+    const int renderIterations = iterationMaximum * 4;
+    const unsigned int threadCount = ThreadConfig::current().threadCount();
+
+    std::filesystem::path directory =
+        std::filesystem::temp_directory_path() /
+        "mandelbrot-recolour-benchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    std::cout << "recolour: " << location.name << ", " << renderWidth << "x"
+              << renderHeight << ", " << renderIterations
+              << " iterations, with distances, " << threadCount
+              << " threads\n";
+
+    Solver solver;
+    solver.setVerbose(false);
+    solver.setMaxIterationCount(renderIterations);
+    solver.setDistanceEstimation(true);
+    solver.initializeGrid(renderWidth, renderHeight, location.viewCenterReal,
+                          location.viewCenterImag, location.viewScale);
+    auto start = std::chrono::steady_clock::now();
+    solver.solve();
+    double solveSeconds = secondsSince(start);
+    Solver::FrameData frameData;
+    solver.getFrameData(frameData);
+    RawFrame frame = RawFrame::fromFrameData(frameData, renderIterations);
+
+    std::cout << std::fixed << std::setprecision(3) << "  solve "
+              << solveSeconds << " s\n";
+
+    bool passed = true;
+    std::size_t uncompressedSize = 0;
+    for (auto compression :
+         {RawFrame::Compression::none, RawFrame::Compression::zlib}) {
+        bool isCompressed = compression == RawFrame::Compression::zlib;
+        std::string path =
+            (directory / (isCompressed ? "compressed.mbraw" : "raw.mbraw"))
+                .string();
+
+        start = std::chrono::steady_clock::now();
+        frame.write(path, compression);
+        double writeSeconds = secondsSince(start);
+        std::size_t size = std::filesystem::file_size(path);
+        if (!isCompressed) {
+            uncompressedSize = size;
+        }
+
+        // Reading is the part every recolouring pays.
+        start = std::chrono::steady_clock::now();
+        RawFrameFile file(path);
+        double loadSeconds = secondsSince(start);
+        bool isIdentical =
+            std::ranges::equal(file.smoothIterations(),
+                               frame.smoothIterations) and
+            std::ranges::equal(file.cumulativeCounts(),
+                               frame.cumulativeCounts) and
+            std::ranges::equal(file.distances(), frame.distances);
+        passed = passed and isIdentical;
+
+        double recolourSeconds = 0.0;
+        for (int palette = 0; palette < 4; palette++) {
+            Recolourer recolourer(threadCount, palette);
+            start = std::chrono::steady_clock::now();
+            recolourer.recolour(
+                file,
+                (directory / (std::to_string(palette) + ".png")).string(),
+                threadCount);
+            recolourSeconds += secondsSince(start);
+        }
+        recolourSeconds /= 4.0;
+
+        std::cout << "  " << std::left << std::setw(11)
+                  << (isCompressed ? "compressed" : "raw") << std::right
+                  << std::setw(6) << size / 1048576.0 << " MiB ("
+                  << std::setprecision(1) << 100.0 * size / uncompressedSize
+                  << "%), write " << std::setprecision(3) << writeSeconds
+                  << " s, load " << loadSeconds << " s, recolour "
+                  << recolourSeconds << " s per palette, "
+                  << std::setprecision(1)
+                  << solveSeconds / (loadSeconds + recolourSeconds)
+                  << "x faster than solving  "
+                  << (isIdentical ? "ok" : "FAILED") << "\n";
+        std::cout << std::setprecision(3);
+    }
+    std::cout.unsetf(std::ios::floatfield);
+
+    std::filesystem::remove_all(directory);
+    return passed;
+}
+
+std::vector<int> Benchmark::referenceHistogram(
+    Formula formula, bool mandelbrotMode, double viewCenterReal,
+    double viewCenterImag, double viewScale, double constantReal,
+    double constantImag) const {
+    std::vector<int> histogram(iterationMaximum, 0);
+
+    const std::complex<double> constant(constantReal, constantImag);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            std::complex<double> point =
+                pixelPoint(x, y, width, height, viewCenterReal,
+                           viewCenterImag, viewScale);
+
+            std::complex<double> z = mandelbrotMode ? constant : point;
+            std::complex<double> c = mandelbrotMode ? point : constant;
+
+            for (int i = 0; i < iterationMaximum; i++) {
+                z = referenceStep(formula, z, c);
+                if (std::norm(z) > 256.0 * 256.0) {
+                    histogram[i]++;
+                    break;
+                }
+            }
+        }
+    }
+
+    return histogram;
+}
@@ -0,0 +1,102 @@
+#ifndef _MANDELBROTBENCHMARK
+#define _MANDELBROTBENCHMARK
+
+#include <string_view>
+#include <vector>
+
+#include "formula.hpp"
+
+// Headless benchmarks, run with --benchmark [<name>...].
+// Each benchmark prints its measurements and returns false if a correctness
+// check failed.
+class Benchmark {
+public:
+    Benchmark();
+
+    // Runs the named benchmarks, or all of them if no names are given.
+    // Returns the process exit code.
+    int run(const std::vector<std::string_view>& names);
+
+private:
+    int width, height;
+    int iterationMaximum;
+
+    // Times every formula in both modes through the solver and checks the
+    // escape histogram against a plain std::complex reference implementation.
+    bool benchmarkKernels();
+
+    // Times the default view with and without symmetry and checks that both
+    // give the same image.
+    bool benchmarkSymmetry();
+
+    // Times the test locations at every thread count from one up to the
+    // configured count, reporting parallel efficiency.
+    bool benchmarkScaling();
+
+    // Runs the solver loop at a larger size with uniform and foveated
+    // scheduling, timing how long a region around the focus and the whole
+    // frame take to match the final image.
+    bool benchmarkFoveation();
+
+    // Starts a tile server on a free local port and loads it from several
+    // client connections with a skewed mix of tiles, reporting throughput,
+    // latency percentiles and cache behaviour.
+    bool benchmarkTiles();
+
+    // Times the solver kernel and histogram shading on grids of every layout,
+    // in their own access orders, and resizing with and without
+    // initialisation.
+    bool benchmarkLayouts();
+
+    // Measures how long julia previews take from request to completion, idle
+    // and while the main solver renders with previews requested every frame,
+    // and how much the previews slow the main render down.
+    bool benchmarkPreview();
+
+    // Times the buddhabrot and anti-buddhabrot at every thread count from one
+    // up to the configured count, reporting samples per second, and checks
+    // that the thread count doesn't change the image.
+    bool benchmarkDensity();
+
+    // Runs the solver loop until it converges, then measures the CPU time it
+    // uses while idle, and checks that a command wakes it again.
+    bool benchmarkIdle();
+
+    // Times the test locations with and without distance estimation and
+    // boundary refinement, against uniform 2x2 supersampling with the same
+    // raised iteration count, and checks that refinement only adds escapes.
+    bool benchmarkDistance();
+
+    // Times histogram colouring of frames arriving during a deep render, with
+    // prefix sums rebuilt over every iteration for each frame against the
+    // incrementally published escape histogram, and checks that both colour
+    // pixels alike.
+    bool benchmarkHistogram();
+
+    // Renders a manifest of thumbnails and a few larger images with the batch
+    // renderer and one image at a time with a fully parallel solver each, as
+    // serial runs of the command line would, reporting images per second.
+    // Checks that images rendered in one band come out identical.
+    bool benchmarkBatch();
+
+    // Iterates the pixels of the kernels benchmark's views as point batches
+    // through the embeddable point solver, with and without distance
+    // estimation, reporting points and iterations per second, and checks the
+    // escapes against the reference implementation.
+    bool benchmarkPoints();
+
+    // Renders a deep view with distance estimation, then writes it as a raw
+    // frame with and without compression and recolours it with every palette,
+    // reporting file sizes and times against solving. Checks that the arrays
+    // read back identical.
+    bool benchmarkRecolour();
+
+    std::vector<int> referenceHistogram(Formula formula, bool mandelbrotMode,
+                                        double viewCenterReal,
+                                        double viewCenterImag,
+                                        double viewScale,
+                                        double constantReal,
+                                        double constantImag) const;
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+static_assert(std::is_trivially_copyable_v<Complex>);
+static_assert(std::is_trivially_copyable_v<Checkpoint::Header>);
+
+namespace {
+
+constexpr char checkpointMagic[8] = {'M', 'B', 'X', 'C', 'K', 'P', 'T', '\0'};
+constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+std::size_t padded(std::size_t size) { return (size + 7) & ~std::size_t(7); }
+
+template <typename T>
+void writeArray(std::ofstream& file, const std::vector<T>& array) {
+    static constexpr char padding[8] = {};
+    std::size_t size = array.size() * sizeof(T);
+    file.write(reinterpret_cast<const char*>(array.data()), size);
+    file.write(padding, padded(size) - size);
+}
+
+} // namespace
+
+void Checkpoint::write(const std::string& path) const {
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("could not open " + temporaryPath);
+        }
+
+        Header fileHeader = header;
+        std::memcpy(fileHeader.magic, checkpointMagic, sizeof(checkpointMagic));
+        fileHeader.version = currentVersion;
+        fileHeader.byteOrder = byteOrderMark;
+        fileHeader.liveCount = liveValues.size();
+
+        static constexpr char padding[8] = {};
+        file.write(reinterpret_cast<const char*>(&fileHeader),
+                   sizeof(fileHeader));
+        file.write(padding, padded(sizeof(fileHeader)) - sizeof(fileHeader));
+
+        writeArray(file, smoothIterations);
+        writeArray(file, escapeIterationCounter);
+        writeArray(file, liveValues);
+        writeArray(file, liveIndices);
+        writeArray(file, liveIterations);
+
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("could not write " + temporaryPath);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        throw std::runtime_error("could not replace " + path + ": " +
+                                 error.message());
+    }
+}
+
+CheckpointFile::CheckpointFile(const std::string& path)
+    : m_file(path), m_data(m_file.data()), m_size(m_file.size()) {
+    auto invalid = [&path](const std::string& reason) {
+        return std::runtime_error(path + " is not a valid checkpoint: " +
+                                  reason);
+    };
+
+    if (m_size < sizeof(Checkpoint::Header) or
+        std::memcmp(m_data, checkpointMagic, sizeof(checkpointMagic)) != 0) {
+        throw invalid("bad magic");
+    }
+    const Checkpoint::Header& fileHeader = header();
+    if (fileHeader.version != Checkpoint::currentVersion) {
+        throw invalid("version " + std::to_string(fileHeader.version) +
+                      ", expected " +
+                      std::to_string(Checkpoint::currentVersion));
+    }
+    if (fileHeader.byteOrder != byteOrderMark) {
+        throw invalid("written with a different byte order");
+    }
+
+    std::size_t pixelCount =
+        static_cast<std::size_t>(fileHeader.width) * fileHeader.height;
+    if (fileHeader.width <= 0 or fileHeader.height <= 0 or
+        fileHeader.iterationMaximum <= 0 or
+        fileHeader.liveCount > pixelCount) {
+        throw invalid("bad dimensions");
+    }
+
+    m_smoothIterationsOffset = padded(sizeof(Checkpoint::Header));
+    m_escapeIterationCounterOffset =
+        m_smoothIterationsOffset + padded(pixelCount * sizeof(float));
+    m_liveValuesOffset = m_escapeIterationCounterOffset +
+                         padded(fileHeader.iterationMaximum * sizeof(int));
+    m_liveIndicesOffset =
+        m_liveValuesOffset + padded(fileHeader.liveCount * sizeof(Complex));
+    m_liveIterationsOffset =
+        m_liveIndicesOffset +
+        padded(fileHeader.liveCount * sizeof(unsigned int));
+    std::size_t expectedSize =
+        m_liveIterationsOffset +
+        padded(fileHeader.liveCount * sizeof(unsigned int));
+    if (m_size != expectedSize) {
+        throw invalid("truncated");
+    }
+
+    for (unsigned int index : liveIndices()) {
+        if (index >= pixelCount) {
+            throw invalid("pixel index out of range");
+        }
+    }
+    for (unsigned int iteration : liveIterations()) {
+        if (iteration >
+            static_cast<unsigned int>(fileHeader.iterationMaximum)) {
+            throw invalid("iteration count out of range");
+        }
+    }
+}
+
+const Checkpoint::Header& CheckpointFile::header() const {
+    return *reinterpret_cast<const Checkpoint::Header*>(m_data);
+}
+
+std::span<const float> CheckpointFile::smoothIterations() const {
+    return {reinterpret_cast<const float*>(m_data + m_smoothIterationsOffset),
+            static_cast<std::size_t>(header().width) * header().height};
+}
+
+std::span<const int> CheckpointFile::escapeIterationCounter() const {
+    return {
+        reinterpret_cast<const int*>(m_data + m_escapeIterationCounterOffset),
+        static_cast<std::size_t>(header().iterationMaximum)};
+}
+
+std::span<const Complex> CheckpointFile::liveValues() const {
+    return {reinterpret_cast<const Complex*>(m_data + m_liveValuesOffset),
+            header().liveCount};
+}
+
+std::span<const unsigned int> CheckpointFile::liveIndices() const {
+    return {
+        reinterpret_cast<const unsigned int*>(m_data + m_liveIndicesOffset),
+        header().liveCount};
+}
+
+std::span<const unsigned int> CheckpointFile::liveIterations() const {
+    return {
+        reinterpret_cast<const unsigned int*>(m_data + m_liveIterationsOffset),
+        header().liveCount};
+}
+
+CheckpointWriter::CheckpointWriter() {
+    isPending = false;
+    isWriting = false;
+    isStopping = false;
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        isStopping = true;
+    }
+    writerCondition.notify_one();
+}
+
+bool CheckpointWriter::submit(Checkpoint& checkpoint,
+                              const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        if (isPending or isWriting) {
+            return false;
+        }
+        std::swap(pending, checkpoint);
+        pendingPath = path;
+        isPending = true;
+
+        // Started with the first checkpoint, most solvers never write one.
+        if (!writerThread.joinable()) {
+            writerThread = std::jthread(&CheckpointWriter::writeLoop, this);
+        }
+    }
+    writerCondition.notify_one();
+    return true;
+}
+
+void CheckpointWriter::write(const Checkpoint& checkpoint,
+                             const std::string& path) {
+    {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        writtenCondition.wait(lock,
+                              [this] { return !isPending and !isWriting; });
+        isWriting = true;
+    }
+    auto finishWriting = [this] {
+        {
+            std::lock_guard<std::mutex> lock(writerMutex);
+            isWriting = false;
+        }
+        writtenCondition.notify_all();
+    };
+
+    try {
+        checkpoint.write(path);
+    } catch (...) {
+        finishWriting();
+        throw;
+    }
+    finishWriting();
+}
+
+void CheckpointWriter::writeLoop() {
+    std::unique_lock<std::mutex> lock(writerMutex);
+    while (true) {
+        writerCondition.wait(lock, [this] { return isPending or isStopping; });
+        if (!isPending) {
+            return;
+        }
+
+        isPending = false;
+        isWriting = true;
+        lock.unlock();
+
+        try {
+            pending.write(pendingPath);
+        } catch (const std::exception& exception) {
+            std::cerr << "checkpoint failed: " << exception.what() << "\n";
+        }
+
+        lock.lock();
+        isWriting = false;
+        writtenCondition.notify_all();
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef _MANDELBROTCHECKPOINT
+#define _MANDELBROTCHECKPOINT
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "complex.hpp"
+#include "mappedfile.hpp"
+
+// Solver state at the end of a pass, so a long render can be resumed.
+// Stored as a versioned binary file: the header followed by the arrays in the
+// order below, each padded to 8 bytes, in the byte order of the machine that
+// wrote it.
+struct Checkpoint {
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+
+        std::int32_t width, height;
+        double viewCenterReal, viewCenterImag, viewScale;
+        double constantReal, constantImag;
+        std::int32_t formula;
+        std::int32_t mandelbrotMode;
+        std::int32_t iterationMaximum;
+        std::int32_t symmetry;
+        double escapeRadius;
+        std::int64_t mirrorColumn, mirrorRow;
+
+        std::int32_t iterationCount;
+        std::int32_t escapeCount;
+        std::uint64_t liveCount;
+    };
+
+    Header header;
+    std::vector<float> smoothIterations;
+    std::vector<int> escapeIterationCounter;
+    std::vector<Complex> liveValues;
+    std::vector<unsigned int> liveIndices;
+    std::vector<unsigned int> liveIterations;
+
+    static constexpr std::uint32_t currentVersion = 1;
+
+    // Writes to a temporary file next to path and renames it over path, so
+    // an interrupted write never replaces a good checkpoint.
+    // Throws std::runtime_error if the file can't be written.
+    void write(const std::string& path) const;
+};
+
+// Read-only view of a checkpoint file, memory mapped where supported so the
+// arrays are paged straight from the file into the solver.
+class CheckpointFile {
+public:
+    // Throws std::runtime_error if the file can't be read or isn't a
+    // checkpoint of the current version.
+    explicit CheckpointFile(const std::string& path);
+
+    CheckpointFile(const CheckpointFile&) = delete;
+    CheckpointFile& operator=(const CheckpointFile&) = delete;
+
+    const Checkpoint::Header& header() const;
+    std::span<const float> smoothIterations() const;
+    std::span<const int> escapeIterationCounter() const;
+    std::span<const Complex> liveValues() const;
+    std::span<const unsigned int> liveIndices() const;
+    std::span<const unsigned int> liveIterations() const;
+
+private:
+    MappedFile m_file;
+    const unsigned char* m_data;
+    std::size_t m_size;
+
+    std::size_t m_smoothIterationsOffset;
+    std::size_t m_escapeIterationCounterOffset;
+    std::size_t m_liveValuesOffset;
+    std::size_t m_liveIndicesOffset;
+    std::size_t m_liveIterationsOffset;
+};
+
+// Writes checkpoints on a background thread, one at a time.
+class CheckpointWriter {
+public:
+    CheckpointWriter();
+    ~CheckpointWriter();
+
+    // Swaps checkpoint with the writer's buffer and starts writing it to path,
+    // unless the previous checkpoint is still being written. Returns whether
+    // the checkpoint was taken. checkpoint is left holding an old buffer to
+    // reuse for the next snapshot.
+    bool submit(Checkpoint& checkpoint, const std::string& path);
+    // Writes checkpoint to path on the calling thread, after waiting for any
+    // submitted checkpoint to be written, so the two never share the
+    // temporary file. Throws std::runtime_error if it can't be written.
+    void write(const Checkpoint& checkpoint, const std::string& path);
+
+private:
+    Checkpoint pending;
+    std::string pendingPath;
+    bool isPending;
+    bool isWriting;
+    bool isStopping;
+    std::mutex writerMutex;
+    std::condition_variable writerCondition;
+    // Notified when a write finishes.
+    std::condition_variable writtenCondition;
+    std::jthread writerThread;
+
+    // Writes submitted checkpoints until stopped, finishing any pending one.
+    void writeLoop();
+};
+
+#endif
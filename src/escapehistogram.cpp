@@ -0,0 +1,112 @@
+#include "escapehistogram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <span>
+#include <vector>
+
+namespace {
+
+// Versions are unique across histograms, so a table copied from one
+// histogram is never mistaken for the current table of another.
+std::atomic_ulong lastVersion = 0;
+
+} // namespace
+
+float EscapeHistogram::Table::fraction(double iterationIndex) const {
+    if (cumulativeCounts.empty()) {
+        return 0.0f;
+    }
+
+    double position = std::clamp(binPosition(iterationIndex), 0.0,
+                                 cumulativeCounts.size() - 1.0);
+    std::size_t a = static_cast<std::size_t>(position);
+    std::size_t b = std::min(a + 1, cumulativeCounts.size() - 1);
+    float i = static_cast<float>(position - a);
+    return (cumulativeCounts[a] +
+            i * (cumulativeCounts[b] - cumulativeCounts[a])) *
+           scale;
+}
+
+EscapeHistogram::EscapeHistogram() {
+    m_lowestChangedBin = 0;
+    reset(1);
+}
+
+void EscapeHistogram::reset(unsigned int iterationMaximum) {
+    std::size_t binCount = binOf(std::max(iterationMaximum, 1u)) + 1;
+    m_counts.assign(iterationMaximum, 0);
+    m_binCounts.assign(binCount, 0);
+    m_cumulativeCounts.assign(binCount, 0);
+
+    m_table.cumulativeCounts.assign(binCount, 0.0f);
+    m_table.scale = 0.0f;
+    m_table.version = ++lastVersion;
+    m_lowestChangedBin = binCount;
+}
+
+void EscapeHistogram::assign(std::span<const int> counts) {
+    reset(counts.size());
+    std::ranges::copy(counts, m_counts.begin());
+    for (std::size_t i = 0; i < m_counts.size(); i++) {
+        m_binCounts[binOf(i + 1)] += m_counts[i];
+    }
+    m_lowestChangedBin = 0;
+}
+
+void EscapeHistogram::add(unsigned int iteration, int count) {
+    std::atomic_ref<int>(m_counts[iteration - 1]) += count;
+    std::size_t bin = binOf(iteration);
+    std::atomic_ref<int>(m_binCounts[bin]) += count;
+
+    // Escapes of a pass mostly share an iteration, so this rarely writes.
+    std::size_t lowest = m_lowestChangedBin.load(std::memory_order_relaxed);
+    while (bin < lowest and
+           !m_lowestChangedBin.compare_exchange_weak(
+               lowest, bin, std::memory_order_relaxed)) {
+    }
+}
+
+const std::vector<int>& EscapeHistogram::counts() const { return m_counts; }
+
+void EscapeHistogram::publish() {
+    std::size_t lowest = m_lowestChangedBin.exchange(m_binCounts.size());
+    if (lowest >= m_binCounts.size()) {
+        return;
+    }
+
+    long sum = lowest == 0 ? 0 : m_cumulativeCounts[lowest - 1];
+    for (std::size_t bin = lowest; bin < m_binCounts.size(); bin++) {
+        sum += m_binCounts[bin];
+        m_cumulativeCounts[bin] = sum;
+        m_table.cumulativeCounts[bin] = static_cast<float>(sum);
+    }
+    m_table.scale = sum > 0 ? 1.0f / static_cast<float>(sum) : 0.0f;
+    m_table.version = ++lastVersion;
+}
+
+void EscapeHistogram::copyTo(Table& table) const {
+    if (table.version != m_table.version) {
+        table = m_table;
+    }
+}
+
+std::size_t EscapeHistogram::memoryUsage() const {
+    return m_counts.capacity() * sizeof(int) +
+           m_binCounts.capacity() * sizeof(int) +
+           m_cumulativeCounts.capacity() * sizeof(long) +
+           m_table.cumulativeCounts.capacity() * sizeof(float);
+}
+
+double EscapeHistogram::binPosition(double iterationIndex) {
+    if (iterationIndex < linearBinCount) {
+        return iterationIndex;
+    }
+    return linearBinCount +
+           std::log2(iterationIndex / linearBinCount) * binsPerOctave;
+}
+
+std::size_t EscapeHistogram::binOf(unsigned int iteration) {
+    return static_cast<std::size_t>(binPosition(iteration - 1.0));
+}
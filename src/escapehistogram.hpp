@@ -0,0 +1,69 @@
+#ifndef _MANDELBROTESCAPEHISTOGRAM
+#define _MANDELBROTESCAPEHISTOGRAM
+
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// Counts of the iterations at which pixels escape, for histogram colouring.
+// Workers add escapes as they happen. publish() then updates the cumulative
+// distribution from the lowest bin that changed, and stamps it with a new
+// version, so readers holding the current version skip copying it.
+// Iterations up to linearBinCount get a bin each, later ones share bins of
+// logarithmically growing size, so the table stays small for very high
+// iteration counts.
+class EscapeHistogram {
+public:
+    static constexpr unsigned int linearBinCount = 1024;
+    static constexpr unsigned int binsPerOctave = 128;
+
+    // Cumulative escape counts per bin, which scale normalises to fractions
+    // of all escapes.
+    struct Table {
+        std::vector<float> cumulativeCounts;
+        float scale = 0.0f;
+        // Zero for a table that was never published.
+        unsigned long version = 0;
+
+        // Fraction of escaped pixels that escaped by a continuous iteration
+        // index, where 0 is the first iteration, interpolated between bins.
+        float fraction(double iterationIndex) const;
+    };
+
+    EscapeHistogram();
+
+    // Clears the counts, for iterations from 1 to iterationMaximum.
+    void reset(unsigned int iterationMaximum);
+    // Replaces the counts with ones returned by counts().
+    void assign(std::span<const int> counts);
+
+    // Adds count escapes at an iteration from 1 to the maximum. Safe to call
+    // from several threads at once, but not concurrently with anything else.
+    void add(unsigned int iteration, int count);
+
+    // Escapes per iteration, starting with the first.
+    const std::vector<int>& counts() const;
+
+    // Brings the table up to date with the escapes added since the last call.
+    void publish();
+    // Copies the published table into table unless it's already current.
+    void copyTo(Table& table) const;
+
+    std::size_t memoryUsage() const;
+
+    // Continuous bin position of a continuous iteration index.
+    static double binPosition(double iterationIndex);
+
+private:
+    std::vector<int> m_counts;
+    std::vector<int> m_binCounts;
+    std::vector<long> m_cumulativeCounts;
+    // Bins from this one on changed since the last publish.
+    std::atomic<std::size_t> m_lowestChangedBin;
+    Table m_table;
+
+    static std::size_t binOf(unsigned int iteration);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef _MANDELBROTFORMULA
+#define _MANDELBROTFORMULA
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "complex.hpp"
+
+// Iteration formulas of the form z -> f(z) + c.
+// The formula is chosen at runtime, but the solver's kernel is compiled once
+// per formula type below so there is no per-pixel branching on it.
+// stepDerivative(z, dz) sets dz to f'(z) dz, for distance estimation, with z
+// from before the step. Burning ship and tricorn aren't analytic, they apply
+// their fold to dz as well, which is a common approximation.
+enum class Formula {
+    mandelbrot,
+    burningShip,
+    tricorn,
+    multibrot3,
+    multibrot4,
+};
+constexpr int formulaCount = 5;
+
+constexpr std::string_view formulaName(Formula formula) {
+    switch (formula) {
+    case Formula::mandelbrot:
+        return "mandelbrot";
+    case Formula::burningShip:
+        return "burning ship";
+    case Formula::tricorn:
+        return "tricorn";
+    case Formula::multibrot3:
+        return "multibrot 3";
+    case Formula::multibrot4:
+        return "multibrot 4";
+    }
+    return "unknown";
+}
+
+// Formula name with dashes for spaces, as in tile paths and batch manifests.
+inline std::string formulaSlug(Formula formula) {
+    std::string slug(formulaName(formula));
+    std::replace(slug.begin(), slug.end(), ' ', '-');
+    return slug;
+}
+
+inline std::optional<Formula> formulaFromSlug(std::string_view slug) {
+    for (int i = 0; i < formulaCount; i++) {
+        if (slug == formulaSlug(static_cast<Formula>(i))) {
+            return static_cast<Formula>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+// f(conj(z)) + conj(c) == conj(f(z) + c), so the mandelbrot set of the formula
+// with a real initial z is symmetric about the real axis.
+constexpr bool hasConjugateSymmetry(Formula formula) {
+    return formula != Formula::burningShip;
+}
+
+// f(-z) == f(z), so every julia set of the formula is symmetric under a 180
+// degree rotation about the origin.
+constexpr bool hasPointSymmetry(Formula formula) {
+    return formula != Formula::multibrot3;
+}
+
+// z -> z^2 + c
+struct MandelbrotFormula {
+    static constexpr int degree = 2;
+
+    static void step(Complex& z, const Complex& c) {
+        double realSquared = z.real * z.real;
+        double imagSquared = z.imag * z.imag;
+        z.imag = (z.real + z.real) * z.imag + c.imag;
+        z.real = realSquared - imagSquared + c.real;
+    }
+
+    static void stepDerivative(const Complex& z, Complex& dz) {
+        double real = 2.0 * (z.real * dz.real - z.imag * dz.imag);
+        dz.imag = 2.0 * (z.real * dz.imag + z.imag * dz.real);
+        dz.real = real;
+    }
+};
+
+// z -> (|re(z)| + i|im(z)|)^2 + c
+struct BurningShipFormula {
+    static constexpr int degree = 2;
+
+    static void step(Complex& z, const Complex& c) {
+        z = {std::abs(z.real), std::abs(z.imag)};
+        MandelbrotFormula::step(z, c);
+    }
+
+    static void stepDerivative(const Complex& z, Complex& dz) {
+        dz = {std::copysign(1.0, z.real) * dz.real,
+              std::copysign(1.0, z.imag) * dz.imag};
+        MandelbrotFormula::stepDerivative(
+            Complex(std::abs(z.real), std::abs(z.imag)), dz);
+    }
+};
+
+// z -> conj(z)^2 + c
+struct TricornFormula {
+    static constexpr int degree = 2;
+
+    static void step(Complex& z, const Complex& c) {
+        z.imag = -z.imag;
+        MandelbrotFormula::step(z, c);
+    }
+
+    static void stepDerivative(const Complex& z, Complex& dz) {
+        dz.imag = -dz.imag;
+        MandelbrotFormula::stepDerivative(Complex(z.real, -z.imag), dz);
+    }
+};
+
+// z -> z^power + c
+template <int power> struct MultibrotFormula {
+    static_assert(power >= 2);
+    static constexpr int degree = power;
+
+    static void step(Complex& z, const Complex& c) {
+        double real = z.real;
+        double imag = z.imag;
+        for (int i = 1; i < power; i++) {
+            double nextReal = real * z.real - imag * z.imag;
+            imag = real * z.imag + imag * z.real;
+            real = nextReal;
+        }
+        z = {real + c.real, imag + c.imag};
+    }
+
+    // power z^(power - 1) dz
+    static void stepDerivative(const Complex& z, Complex& dz) {
+        double real = power * dz.real;
+        double imag = power * dz.imag;
+        for (int i = 1; i < power; i++) {
+            double nextReal = real * z.real - imag * z.imag;
+            imag = real * z.imag + imag * z.real;
+            real = nextReal;
+        }
+        dz = {real, imag};
+    }
+};
+
+// The kernel shared by the solvers. Iterates z from iteration until
+// lastIteration, or until |z|^2 exceeds escapeRadiusSquared, and returns the
+// iteration reached with magnitudeSquared set to the last |z|^2. With distance
+// estimation dz follows along as dz/dc in mandelbrot mode, dz/dz0 in julia
+// mode.
+template <typename FormulaType, bool mandelbrotMode, bool distanceEstimation>
+inline unsigned int iterateOrbit(Complex& z, Complex& dz, const Complex& c,
+                                 unsigned int iteration,
+                                 unsigned int lastIteration,
+                                 double escapeRadiusSquared,
+                                 double& magnitudeSquared) {
+    while (iteration < lastIteration) {
+        if constexpr (distanceEstimation) {
+            FormulaType::stepDerivative(z, dz);
+            if constexpr (mandelbrotMode) {
+                dz.real += 1.0;
+            }
+        }
+        FormulaType::step(z, c);
+        iteration++;
+        magnitudeSquared = z.magnitudeSquared();
+        if (magnitudeSquared > escapeRadiusSquared) {
+            break;
+        }
+    }
+    return iteration;
+}
+
+// Exterior distance estimate of an escaped orbit, half of |z| ln|z| / |dz|,
+// which is a lower bound on the distance to the set.
+inline double exteriorDistance(double magnitudeSquared, Complex dz) {
+    return 0.25 * std::log(magnitudeSquared) *
+           std::sqrt(magnitudeSquared / dz.magnitudeSquared());
+}
+
+#endif
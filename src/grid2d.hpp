@@ -1,69 +1,202 @@
 #ifndef _MANDELBROTGRID2D
 #define _MANDELBROTGRID2D
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <span>
 #include <utility>
 #include <vector>
 
+#include "alignedallocator.hpp"
+
+// Order of a grid's elements in memory.
+// rowMajor: row by row.
+// tiled:    square tiles stored one after another, row by row within a tile.
+// morton:   square tiles stored one after another, in Z-order within a tile.
+// Tiled layouts are padded to whole tiles, so every tile is contiguous.
+enum class GridLayout {
+    rowMajor,
+    tiled,
+    morton,
+};
+
 // grid wrapping std::vector<T> that can be indexed with [x, y] syntax.
-template <typename T> class Grid2d {
+// Storage is cache line aligned, and resizing doesn't initialise elements.
+template <typename T, GridLayout layout = GridLayout::rowMajor> class Grid2d {
 public:
+    // Side length of the tiles of the tiled layouts.
+    static constexpr std::size_t tileSize = 64;
+
     Grid2d() {
         m_width = 0;
         m_height = 0;
+        m_tileColumns = 0;
     }
     Grid2d(std::size_t width, std::size_t height) { resize(width, height); }
 
+    Grid2d(const Grid2d& other) = default;
+    Grid2d(Grid2d&& other) noexcept
+        : m_width(std::exchange(other.m_width, 0ul)),
+          m_height(std::exchange(other.m_height, 0ul)),
+          m_tileColumns(std::exchange(other.m_tileColumns, 0ul)),
+          storage(std::move(other.storage)) {}
     Grid2d& operator=(const Grid2d& other) {
         if (this == &other)
             return *this;
 
         m_width = other.m_width;
         m_height = other.m_height;
+        m_tileColumns = other.m_tileColumns;
 
-        data = other.data;
+        storage = other.storage;
 
         return *this;
     }
-    Grid2d& operator=(Grid2d<T>&& other) noexcept {
+    Grid2d& operator=(Grid2d&& other) noexcept {
         if (this == &other)
             return *this;
 
-        data = std::move(other.data);
+        storage = std::move(other.storage);
         m_width = std::exchange(other.m_width, 0ul);
         m_height = std::exchange(other.m_height, 0ul);
+        m_tileColumns = std::exchange(other.m_tileColumns, 0ul);
 
         return *this;
     }
 
+    // Elements are left uninitialised, contents don't survive a resize.
     void resize(std::size_t width, std::size_t height) {
         m_width = width;
         m_height = height;
-        data.resize(m_width * m_height);
+        if constexpr (layout == GridLayout::rowMajor) {
+            m_tileColumns = 0;
+            storage.resize(m_width * m_height);
+        } else {
+            m_tileColumns = (m_width + tileSize - 1) / tileSize;
+            storage.resize(tileCount() * tileSize * tileSize);
+        }
     }
+    void fill(T value) { std::fill(storage.begin(), storage.end(), value); }
+    // Fills the width by height rectangle in the top left corner.
     void assign(std::size_t width, std::size_t height, T value) {
         assert(width <= m_width and height <= m_height);
 
-        for (unsigned int y = 0; y < height; y++) {
-            for (unsigned int x = 0; x < width; x++) {
-                (*this)[x, y] = value;
+        for (std::size_t y = 0; y < height; y++) {
+            if constexpr (layout == GridLayout::rowMajor) {
+                std::fill_n(row(y).begin(), width, value);
+            } else {
+                for (std::size_t x = 0; x < width; x++) {
+                    (*this)[x, y] = value;
+                }
             }
         }
     }
 
     T& operator[](std::size_t x, std::size_t y) {
         assert(x < m_width and y < m_height);
-        return data[y * m_width + x];
+        return storage[indexOf(x, y)];
+    }
+    const T& operator[](std::size_t x, std::size_t y) const {
+        assert(x < m_width and y < m_height);
+        return storage[indexOf(x, y)];
+    }
+    // Flat indexing, index = y * width + x. Tiled layouts are padded, so
+    // only row major grids have it, use elements() for storage order.
+    T& operator[](std::size_t index)
+        requires(layout == GridLayout::rowMajor)
+    {
+        assert(index < storage.size());
+        return storage[index];
+    }
+    const T& operator[](std::size_t index) const
+        requires(layout == GridLayout::rowMajor)
+    {
+        assert(index < storage.size());
+        return storage[index];
+    }
+
+    // Index of (x, y) in storage order.
+    std::size_t indexOf(std::size_t x, std::size_t y) const {
+        if constexpr (layout == GridLayout::rowMajor) {
+            return y * m_width + x;
+        } else {
+            std::size_t tile = (y / tileSize) * m_tileColumns + x / tileSize;
+            x %= tileSize;
+            y %= tileSize;
+            if constexpr (layout == GridLayout::tiled) {
+                return tile * tileSize * tileSize + y * tileSize + x;
+            } else {
+                return tile * tileSize * tileSize +
+                       (spreadBits(x) | (spreadBits(y) << 1));
+            }
+        }
+    }
+
+    // Contiguous row of a row major grid.
+    std::span<T> row(std::size_t y)
+        requires(layout == GridLayout::rowMajor)
+    {
+        assert(y < m_height);
+        return {storage.data() + y * m_width, m_width};
+    }
+    std::span<const T> row(std::size_t y) const
+        requires(layout == GridLayout::rowMajor)
+    {
+        assert(y < m_height);
+        return {storage.data() + y * m_width, m_width};
+    }
+
+    // Contiguous tile of a tiled grid, tiles are numbered row by row and
+    // include the padding past the edges of the grid.
+    std::span<T> tile(std::size_t index)
+        requires(layout != GridLayout::rowMajor)
+    {
+        assert(index < tileCount());
+        return {storage.data() + index * tileSize * tileSize,
+                tileSize * tileSize};
     }
+    std::span<const T> tile(std::size_t index) const
+        requires(layout != GridLayout::rowMajor)
+    {
+        assert(index < tileCount());
+        return {storage.data() + index * tileSize * tileSize,
+                tileSize * tileSize};
+    }
+    std::size_t tileColumns() const { return m_tileColumns; }
+    std::size_t tileCount() const {
+        return m_tileColumns * ((m_height + tileSize - 1) / tileSize);
+    }
+
+    // All elements in storage order, including padding.
+    std::span<T> elements() { return storage; }
+    std::span<const T> elements() const { return storage; }
+    T* data() { return storage.data(); }
+    const T* data() const { return storage.data(); }
 
     std::size_t width() const { return m_width; }
     std::size_t height() const { return m_height; }
-    std::size_t size() const { return m_width * m_height; }
+    // Number of elements, for flat indexing. Tiled layouts hold more,
+    // elements() includes their padding.
+    std::size_t size() const
+        requires(layout == GridLayout::rowMajor)
+    {
+        return m_width * m_height;
+    }
 
 private:
     std::size_t m_width;
     std::size_t m_height;
-    std::vector<T> data;
+    std::size_t m_tileColumns;
+    std::vector<T, AlignedAllocator<T>> storage;
+
+    // Spreads the bits of a tile coordinate to every other bit, for Z-order.
+    static std::size_t spreadBits(std::size_t value) {
+        value = (value | (value << 4)) & 0x0f0f;
+        value = (value | (value << 2)) & 0x3333;
+        value = (value | (value << 1)) & 0x5555;
+        return value;
+    }
 };
 
 #endif
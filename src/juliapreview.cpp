@@ -0,0 +1,152 @@
+#include "juliapreview.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "threadconfig.hpp"
+#include "trace.hpp"
+
+JuliaPreview::JuliaPreview(int size, int iterationMaximum,
+                           std::chrono::microseconds budget,
+                           std::chrono::microseconds frameInterval,
+                           std::function<void()> onFrame)
+    : m_size(size), m_iterationMaximum(iterationMaximum), m_budget(budget),
+      m_frameInterval(frameInterval), m_onFrame(std::move(onFrame)) {
+    isPending = false;
+    isFrameReady = false;
+    shading.setShadingFunction(2);
+
+    worker = std::jthread(
+        [this](std::stop_token stopToken) { workLoop(stopToken); });
+}
+
+void JuliaPreview::request(Formula formula, Complex constant) {
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        pending = {.formula = formula,
+                   .constant = constant,
+                   .time = std::chrono::steady_clock::now()};
+        isPending = true;
+    }
+    requestAvailable.notify_one();
+}
+
+bool JuliaPreview::takeFrame(Frame& frame) {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (!isFrameReady) {
+        return false;
+    }
+    std::swap(readyFrame, frame);
+    isFrameReady = false;
+    return true;
+}
+
+std::vector<double> JuliaPreview::latencies() const {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    return m_latencies;
+}
+
+void JuliaPreview::workLoop(std::stop_token stopToken) {
+    Trace::setThreadName("julia preview");
+    ThreadConfig singleThread;
+    singleThread.setThreadCount(1);
+
+    Solver solver;
+    solver.setVerbose(false);
+    solver.setThreadConfig(singleThread);
+    solver.setMaxIterationCount(m_iterationMaximum);
+    Solver::FrameData frameData;
+    Frame frame;
+
+    while (true) {
+        Request current;
+        {
+            std::unique_lock<std::mutex> lock(requestMutex);
+            if (!requestAvailable.wait(lock, stopToken,
+                                       [this] { return isPending; })) {
+                return;
+            }
+            current = pending;
+            isPending = false;
+        }
+
+        solver.setFormula(current.formula);
+        solver.setFractal(false, current.constant.real, current.constant.imag);
+        solver.initializeGrid(m_size, m_size, 0.0, 0.0, 1.0);
+
+        // One budget per frame interval, leaving the rest of the interval to
+        // the main solver. Shading the partial preview counts against the
+        // budget of the next slice.
+        auto sliceStart = std::chrono::steady_clock::now();
+        std::chrono::nanoseconds shadingTime(0);
+        bool isComplete = false;
+        while (!isComplete) {
+            {
+                TRACE_SCOPE("julia preview slice");
+                isComplete = solver.solveFor(m_budget - shadingTime);
+                auto shadingStart = std::chrono::steady_clock::now();
+                solver.getFrameData(frameData);
+                shade(frameData, frame);
+                shadingTime = std::min<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - shadingStart,
+                    m_budget / 2);
+            }
+            frame.isComplete = isComplete;
+            {
+                std::lock_guard<std::mutex> lock(frameMutex);
+                std::swap(readyFrame, frame);
+                isFrameReady = true;
+            }
+            if (m_onFrame) {
+                m_onFrame();
+            }
+
+            if (isComplete) {
+                std::lock_guard<std::mutex> lock(requestMutex);
+                m_latencies.push_back(
+                    std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - current.time)
+                        .count());
+                break;
+            }
+
+            // Newer requests replace this one without waiting out the slice.
+            sliceStart += m_frameInterval;
+            std::unique_lock<std::mutex> lock(requestMutex);
+            if (requestAvailable.wait_until(lock, stopToken, sliceStart,
+                                            [this] { return isPending; }) or
+                stopToken.stop_requested()) {
+                break;
+            }
+        }
+    }
+}
+
+void JuliaPreview::shade(const Solver::FrameData& frameData,
+                         Frame& frame) const {
+    const auto& smoothIterationGrid = frameData.smoothIterationGrid;
+
+    auto toArgb = [](Shading::Colour colour) -> std::uint32_t {
+        return 0xff000000u | (get<0>(colour) << 16) | (get<1>(colour) << 8) |
+               get<2>(colour);
+    };
+
+    frame.size = smoothIterationGrid.width();
+    frame.pixels.resize(smoothIterationGrid.size());
+
+    const std::uint32_t background = toArgb(shading.shade(1.0, 0.0));
+    for (std::size_t i = 0; i < smoothIterationGrid.size(); i++) {
+        if (smoothIterationGrid[i] >= 0.0f) {
+            frame.pixels[i] =
+                toArgb(shading.shadeSmooth(smoothIterationGrid[i], 0.0));
+        } else {
+            frame.pixels[i] = background;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef _MANDELBROTJULIAPREVIEW
+#define _MANDELBROTJULIAPREVIEW
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "complex.hpp"
+#include "formula.hpp"
+#include "shading.hpp"
+#include "solver.hpp"
+
+// Renders small previews of julia sets on a dedicated worker with its own
+// single threaded solver, so the main solver isn't disturbed.
+// Only the latest request is rendered. The worker spends at most its budget
+// per frame interval on it, publishing the partial preview after each slice,
+// until the preview is complete or replaced by a newer request.
+class JuliaPreview {
+public:
+    // Shaded ARGB pixels of a square preview.
+    struct Frame {
+        std::vector<std::uint32_t> pixels;
+        int size = 0;
+        bool isComplete = false;
+    };
+
+    // onFrame is called on the worker whenever a new frame can be taken.
+    JuliaPreview(int size, int iterationMaximum,
+                 std::chrono::microseconds budget,
+                 std::chrono::microseconds frameInterval,
+                 std::function<void()> onFrame);
+
+    // Replaces any earlier request. Thread safe.
+    void request(Formula formula, Complex constant);
+
+    // Swaps the latest frame into frame if there is a new one.
+    bool takeFrame(Frame& frame);
+
+    // Milliseconds from request to complete preview, for previews that
+    // weren't replaced before completing.
+    std::vector<double> latencies() const;
+
+private:
+    int m_size;
+    int m_iterationMaximum;
+    std::chrono::microseconds m_budget;
+    std::chrono::microseconds m_frameInterval;
+    std::function<void()> m_onFrame;
+
+    struct Request {
+        Formula formula = Formula::mandelbrot;
+        Complex constant;
+        std::chrono::steady_clock::time_point time;
+    };
+    Request pending;
+    bool isPending;
+    mutable std::mutex requestMutex;
+    std::condition_variable_any requestAvailable;
+
+    Frame readyFrame;
+    bool isFrameReady;
+    std::mutex frameMutex;
+
+    std::vector<double> m_latencies;
+
+    Shading shading;
+
+    // Last, so it is stopped before the rest is destroyed.
+    std::jthread worker;
+
+    void workLoop(std::stop_token stopToken);
+
+    void shade(const Solver::FrameData& frameData, Frame& frame) const;
+};
+
+#endif
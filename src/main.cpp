@@ -1,7 +1,301 @@
 #include "application.hpp"
 
-int main() {
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch.hpp"
+#include "benchmark.hpp"
+#include "poster.hpp"
+#include "recolour.hpp"
+#include "threadconfig.hpp"
+#include "tileserver.hpp"
+#include "trace.hpp"
+
+namespace {
+
+void printUsage() {
+    std::cerr << "usage: mandelbrot [--checkpoint <file> [<seconds>]] "
+                 "[--export <file.mbraw>] [<thread options>]\n"
+                 "       mandelbrot --poster <width> <height> <output.png> "
+                 "[<real> <imag> <scale>]\n"
+                 "       mandelbrot --serve <port> [<cache tiles> "
+                 "[<iterations>]]\n"
+                 "       mandelbrot --batch <manifest> [<report.csv>]\n"
+                 "       mandelbrot --recolour <palette> <input.mbraw> "
+                 "<output.png> [<input> <output>...]\n"
+                 "       mandelbrot --benchmark [<name>...]\n"
+                 "thread options:\n"
+                 "       --threads <count>   or MANDELBROT_THREADS\n"
+                 "       --cpus <list>       or MANDELBROT_CPUS, e.g. 0-3,8\n"
+                 "       --smt <all|off>     or MANDELBROT_SMT\n"
+                 "       --trace <file>      write a timeline on exit and "
+                 "on T, needs make TRACE=1\n";
+}
+
+int runPoster(const std::vector<std::string_view>& arguments) {
+    if (arguments.size() != 4 and arguments.size() != 7) {
+        printUsage();
+        return 1;
+    }
+
+    double viewCenterReal = -0.5;
+    double viewCenterImag = 0.0;
+    double viewScale = 1.0;
+    if (arguments.size() == 7) {
+        viewCenterReal = std::stod(std::string(arguments[4]));
+        viewCenterImag = std::stod(std::string(arguments[5]));
+        viewScale = std::stod(std::string(arguments[6]));
+    }
+
+    // Parsed signed so negative sizes are rejected rather than wrapping.
+    long width = std::stol(std::string(arguments[1]));
+    long height = std::stol(std::string(arguments[2]));
+    if (width <= 0 or height <= 0 or width > 1 << 30 or height > 1 << 30) {
+        throw std::runtime_error("poster width and height must be from 1 "
+                                 "to 2^30");
+    }
+
+    auto poster = PosterRenderer(width, height, viewCenterReal,
+                                 viewCenterImag, viewScale);
+    poster.render(std::string(arguments[3]));
+
+    return 0;
+}
+
+int runServer(const std::vector<std::string_view>& arguments) {
+    if (arguments.size() < 2 or arguments.size() > 4) {
+        printUsage();
+        return 1;
+    }
+
+    int port = std::stoi(std::string(arguments[1]));
+    std::size_t cacheCapacity = 4096;
+    if (arguments.size() >= 3) {
+        cacheCapacity = std::stoul(std::string(arguments[2]));
+    }
+    int iterationMaximum = 1024;
+    if (arguments.size() == 4) {
+        iterationMaximum = std::stoi(std::string(arguments[3]));
+    }
+
+    TileServer server(ThreadConfig::current().threadCount(), cacheCapacity,
+                      iterationMaximum);
+    port = server.listen(port);
+    std::cout << "serving tiles on http://127.0.0.1:" << port
+              << "/<formula>/<m|real,imag>/<zoom>/<x>/<y>.<png|raw>\n";
+    server.serve();
+
+    return 0;
+}
+
+int runBatch(const std::vector<std::string_view>& arguments) {
+    if (arguments.size() < 2 or arguments.size() > 3) {
+        printUsage();
+        return 1;
+    }
+
+    std::ifstream manifest{std::string(arguments[1])};
+    if (!manifest) {
+        throw std::runtime_error("could not open " + std::string(arguments[1]));
+    }
+    auto jobs = BatchRenderer::parseManifest(manifest);
+
+    std::size_t pixelCount = 0;
+    for (const auto& job : jobs) {
+        pixelCount += static_cast<std::size_t>(job.width) * job.height;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BatchRenderer renderer(ThreadConfig::current().threadCount());
+    auto reports = renderer.render(jobs);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    // Without a report file the report goes to stdout.
+    if (arguments.size() == 3) {
+        std::ofstream report{std::string(arguments[2])};
+        if (!report) {
+            throw std::runtime_error("could not open " +
+                                     std::string(arguments[2]));
+        }
+        BatchRenderer::writeReport(jobs, reports, report);
+    } else {
+        BatchRenderer::writeReport(jobs, reports, std::cout);
+    }
+
+    std::cout << "rendered " << jobs.size() << " images, "
+              << static_cast<double>(pixelCount) * 1e-6 << " Mpixels, in "
+              << elapsed.count() << " s, "
+              << jobs.size() / elapsed.count() << " images/s\n";
+
+    // Failures are reported after the report, which lists every image.
+    int result = 0;
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        if (!reports[i].isWritten) {
+            std::cerr << "could not write " << jobs[i].output << ": "
+                      << reports[i].error << "\n";
+            result = 1;
+        }
+    }
+    return result;
+}
+
+int runRecolour(const std::vector<std::string_view>& arguments) {
+    if (arguments.size() < 4 or arguments.size() % 2 != 0) {
+        printUsage();
+        return 1;
+    }
+
+    int palette = std::stoi(std::string(arguments[1]));
+    if (palette < 0 or palette > 3) {
+        throw std::runtime_error("palette must be from 0 to 3");
+    }
+    std::vector<Recolourer::Job> jobs;
+    for (std::size_t i = 2; i < arguments.size(); i += 2) {
+        jobs.push_back(
+            {std::string(arguments[i]), std::string(arguments[i + 1])});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Recolourer recolourer(ThreadConfig::current().threadCount(), palette);
+    recolourer.recolour(jobs);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << "recoloured " << jobs.size() << " images in "
+              << elapsed.count() << " s\n";
+
+    return 0;
+}
+
+int runInteractive(const std::vector<std::string_view>& arguments) {
+    std::string checkpointPath;
+    long checkpointSeconds = 60;
+    std::string exportPath;
+    for (std::size_t i = 0; i < arguments.size();) {
+        if (arguments[i] == "--checkpoint" and i + 1 < arguments.size()) {
+            checkpointPath = arguments[i + 1];
+            i += 2;
+            if (i < arguments.size() and !arguments[i].starts_with("--")) {
+                checkpointSeconds = std::stol(std::string(arguments[i]));
+                i++;
+            }
+        } else if (arguments[i] == "--export" and i + 1 < arguments.size()) {
+            exportPath = arguments[i + 1];
+            i += 2;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
     auto application = MandelbrotApplication();
+    if (!checkpointPath.empty()) {
+        application.setCheckpoint(checkpointPath,
+                                  std::chrono::seconds(checkpointSeconds));
+    }
+    if (!exportPath.empty()) {
+        application.setExport(exportPath);
+    }
 
     application.run();
+
+    return 0;
+}
+
+int run(const std::vector<std::string_view>& arguments) {
+    if (!arguments.empty() and arguments[0] == "--poster") {
+        try {
+            return runPoster(arguments);
+        } catch (const std::exception& exception) {
+            std::cerr << "poster render failed: " << exception.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!arguments.empty() and arguments[0] == "--serve") {
+        try {
+            return runServer(arguments);
+        } catch (const std::exception& exception) {
+            std::cerr << "tile server failed: " << exception.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!arguments.empty() and arguments[0] == "--batch") {
+        try {
+            return runBatch(arguments);
+        } catch (const std::exception& exception) {
+            std::cerr << "batch render failed: " << exception.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!arguments.empty() and arguments[0] == "--recolour") {
+        try {
+            return runRecolour(arguments);
+        } catch (const std::exception& exception) {
+            std::cerr << "recolour failed: " << exception.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!arguments.empty() and arguments[0] == "--benchmark") {
+        auto benchmark = Benchmark();
+        return benchmark.run({arguments.begin() + 1, arguments.end()});
+    }
+
+    return runInteractive(arguments);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Thread and trace options can appear anywhere, the rest select the mode.
+    std::vector<std::string_view> arguments;
+    std::string tracePath;
+    try {
+        auto threadConfig = ThreadConfig::fromEnvironment();
+        std::vector<std::string_view> allArguments(argv + 1, argv + argc);
+        for (std::size_t i = 0; i < allArguments.size();) {
+            if (allArguments[i] == "--trace") {
+                if (i + 1 == allArguments.size()) {
+                    throw std::invalid_argument("--trace needs a file");
+                }
+                tracePath = allArguments[i + 1];
+                i += 2;
+            } else if (!threadConfig.parseOption(allArguments, i)) {
+                arguments.push_back(allArguments[i]);
+                i++;
+            }
+        }
+        ThreadConfig::setCurrent(threadConfig);
+    } catch (const std::invalid_argument& exception) {
+        std::cerr << exception.what() << "\n";
+        printUsage();
+        return 1;
+    }
+    std::cout << "solver: " << ThreadConfig::current().describe() << "\n";
+
+    if (!tracePath.empty()) {
+        if (Trace::isCompiledIn) {
+            Trace::setThreadName("main");
+            Trace::start(tracePath);
+        } else {
+            std::cerr << "not tracing, built without MANDELBROT_TRACE, "
+                         "rebuild with make TRACE=1\n";
+        }
+    }
+
+    int exitCode = run(arguments);
+
+    Trace::dump();
+
+    return exitCode;
 }
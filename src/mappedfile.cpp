@@ -0,0 +1,56 @@
+#include "mappedfile.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) or defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MANDELBROT_MMAP
+#endif
+
+MappedFile::MappedFile(const std::string& path) : m_data(nullptr), m_size(0) {
+#ifdef MANDELBROT_MMAP
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("could not open " + path);
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 and status.st_size > 0) {
+        m_size = status.st_size;
+        void* mapping =
+            mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping != MAP_FAILED) {
+            m_data = static_cast<const unsigned char*>(mapping);
+        }
+    }
+    close(descriptor);
+#endif
+
+    if (m_data == nullptr) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("could not open " + path);
+        }
+        m_buffer.resize(file.tellg());
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(m_buffer.data()), m_buffer.size());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+}
+
+MappedFile::~MappedFile() {
+#ifdef MANDELBROT_MMAP
+    if (m_buffer.empty() and m_data != nullptr) {
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+    }
+#endif
+}
+
+const unsigned char* MappedFile::data() const { return m_data; }
+
+std::size_t MappedFile::size() const { return m_size; }
@@ -0,0 +1,29 @@
+#ifndef _MANDELBROTMAPPEDFILE
+#define _MANDELBROTMAPPEDFILE
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only contents of a file, memory mapped where supported so they are
+// paged in as they are used, otherwise read into memory.
+class MappedFile {
+public:
+    // Throws std::runtime_error if the file can't be opened.
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const;
+    std::size_t size() const;
+
+private:
+    const unsigned char* m_data;
+    std::size_t m_size;
+    // Contents of the file when it couldn't be mapped.
+    std::vector<unsigned char> m_buffer;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "pngwriter.hpp"
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <zlib.h>
+
+namespace {
+
+void putUint32(unsigned char* destination, std::uint32_t value) {
+    destination[0] = value >> 24;
+    destination[1] = value >> 16;
+    destination[2] = value >> 8;
+    destination[3] = value;
+}
+
+} // namespace
+
+PngWriter::PngWriter(const std::string& path, unsigned int width,
+                     unsigned int height)
+    : file(path, std::ios::binary), output(file), m_width(width),
+      m_height(height), rowsWritten(0), stream() {
+    if (!file) {
+        throw std::runtime_error("could not open " + path);
+    }
+
+    writeHeader();
+}
+
+PngWriter::PngWriter(std::ostream& destination, unsigned int width,
+                     unsigned int height)
+    : output(destination), m_width(width), m_height(height), rowsWritten(0),
+      stream() {
+    writeHeader();
+}
+
+PngWriter::~PngWriter() { deflateEnd(&stream); }
+
+void PngWriter::writeHeader() {
+    static constexpr std::array<unsigned char, 8> signature = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    output.write(reinterpret_cast<const char*>(signature.data()),
+                 signature.size());
+
+    std::array<unsigned char, 13> header = {};
+    putUint32(&header[0], m_width);
+    putUint32(&header[4], m_height);
+    header[8] = 8;  // bit depth
+    header[9] = 2;  // colour type RGB
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // no interlace
+    writeChunk("IHDR", header.data(), header.size());
+
+    if (deflateInit(&stream, 6) != Z_OK) {
+        throw std::runtime_error("could not initialise png compression");
+    }
+
+    // One filter type byte per row.
+    filteredRow.resize(1 + m_width * 3);
+    compressedBuffer.resize(1 << 16);
+}
+
+void PngWriter::writeRows(const unsigned char* pixels, unsigned int rowCount) {
+    const unsigned int rowLength = m_width * 3;
+
+    for (unsigned int row = 0; row < rowCount; row++) {
+        const unsigned char* source = pixels + row * rowLength;
+
+        // Sub filter, each byte minus the same channel of the previous pixel.
+        filteredRow[0] = 1;
+        for (unsigned int i = 0; i < rowLength; i++) {
+            filteredRow[1 + i] = source[i] - (i < 3 ? 0 : source[i - 3]);
+        }
+
+        stream.next_in = filteredRow.data();
+        stream.avail_in = filteredRow.size();
+        deflateInput(Z_NO_FLUSH);
+    }
+    rowsWritten += rowCount;
+}
+
+void PngWriter::finish() {
+    if (rowsWritten != m_height) {
+        throw std::runtime_error("png finished after " +
+                                 std::to_string(rowsWritten) + " of " +
+                                 std::to_string(m_height) + " rows");
+    }
+
+    stream.next_in = nullptr;
+    stream.avail_in = 0;
+    deflateInput(Z_FINISH);
+
+    writeChunk("IEND", nullptr, 0);
+    output.flush();
+    if (!output) {
+        throw std::runtime_error("could not write png");
+    }
+}
+
+void PngWriter::deflateInput(int flush) {
+    int result;
+    do {
+        stream.next_out = compressedBuffer.data();
+        stream.avail_out = compressedBuffer.size();
+        result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            throw std::runtime_error("png compression failed");
+        }
+
+        std::size_t length = compressedBuffer.size() - stream.avail_out;
+        if (length > 0) {
+            writeChunk("IDAT", compressedBuffer.data(), length);
+        }
+    } while (stream.avail_out == 0 or
+             (flush == Z_FINISH and result != Z_STREAM_END));
+}
+
+void PngWriter::writeChunk(const char* type, const unsigned char* data,
+                           std::size_t length) {
+    std::array<unsigned char, 4> buffer;
+
+    putUint32(buffer.data(), length);
+    output.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+
+    output.write(type, 4);
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+
+    if (length > 0) {
+        output.write(reinterpret_cast<const char*>(data), length);
+        crc = crc32(crc, data, length);
+    }
+
+    putUint32(buffer.data(), crc);
+    output.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    if (!output) {
+        throw std::runtime_error("could not write png");
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef _MANDELBROTPNGWRITER
+#define _MANDELBROTPNGWRITER
+
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+// Streams an 8-bit RGB PNG to disk a band of rows at a time, so the whole image
+// never has to be held in memory. Throws std::runtime_error as soon as the
+// output fails.
+class PngWriter {
+public:
+    PngWriter(const std::string& path, unsigned int width, unsigned int height);
+    // Writes to destination, which must outlive the writer.
+    PngWriter(std::ostream& destination, unsigned int width,
+              unsigned int height);
+    ~PngWriter();
+
+    // Append rows of tightly packed RGB pixels, width * 3 bytes per row.
+    void writeRows(const unsigned char* pixels, unsigned int rowCount);
+
+    // Flush the compressed stream and write the end of the file.
+    // Must be called after all rows have been written.
+    void finish();
+
+private:
+    std::ofstream file;
+    std::ostream& output;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int rowsWritten;
+
+    z_stream stream;
+    std::vector<unsigned char> filteredRow;
+    std::vector<unsigned char> compressedBuffer;
+
+    void writeHeader();
+
+    void deflateInput(int flush);
+
+    void writeChunk(const char* type, const unsigned char* data,
+                    std::size_t length);
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "pointsolver.hpp"
+
+#include <algorithm>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "complex.hpp"
+#include "formula.hpp"
+#include "threadconfig.hpp"
+
+PointSolver::PointSolver() {
+    m_formula = Formula::mandelbrot;
+    m_mandelbrotMode = true;
+    m_constant = {0.0, 0.0};
+    m_iterationMaximum = 8192;
+    m_escapeRadius = 256.0;
+    m_distanceEstimation = false;
+    m_results = nullptr;
+    setThreadConfig(ThreadConfig::current());
+}
+
+void PointSolver::setFormula(Formula formula) { m_formula = formula; }
+
+void PointSolver::setFractal(bool mandelbrotMode, Complex constant) {
+    m_mandelbrotMode = mandelbrotMode;
+    m_constant = constant;
+}
+
+void PointSolver::setMaxIterationCount(unsigned int iterationMaximum) {
+    m_iterationMaximum = iterationMaximum;
+}
+
+void PointSolver::setEscapeRadius(double escapeRadius) {
+    m_escapeRadius = escapeRadius;
+}
+
+void PointSolver::setDistanceEstimation(bool distanceEstimation) {
+    m_distanceEstimation = distanceEstimation;
+}
+
+void PointSolver::setThreadConfig(const ThreadConfig& config) {
+    m_threadCount = config.threadCount();
+    m_workerCpus = config.workerCpus();
+}
+
+void PointSolver::solve(std::span<const Complex> points, Results& results) {
+    results.escapeIterations.resize(points.size());
+    results.magnitudesSquared.resize(points.size());
+    results.distances.resize(m_distanceEstimation ? points.size() : 0);
+    if (points.empty()) {
+        return;
+    }
+
+    m_points = points;
+    m_results = &results;
+    workQueue.setTaskLength(chunkLength);
+    workQueue.setTaskCount((points.size() + chunkLength - 1) / chunkLength);
+    runWorkers(selectChunkIterator());
+    m_points = {};
+    m_results = nullptr;
+}
+
+void PointSolver::runWorkers(Worker worker) {
+    if (m_threadCount == 1 and m_workerCpus.empty()) {
+        (this->*worker)();
+        return;
+    }
+
+    std::vector<std::jthread> threads;
+
+    for (unsigned int i = 0u; i < m_threadCount; i++) {
+        if (m_workerCpus.empty()) {
+            threads.push_back(std::jthread(worker, this));
+        } else {
+            int cpu = m_workerCpus[i % m_workerCpus.size()];
+            threads.push_back(std::jthread([this, worker, cpu] {
+                pinCurrentThread(cpu);
+                (this->*worker)();
+            }));
+        }
+    }
+}
+
+template <typename FormulaType, bool mandelbrotMode, bool distanceEstimation>
+void PointSolver::chunkIterator() {
+    auto [task, length] = workQueue.getTask();
+
+    const double escapeRadiusSquared = m_escapeRadius * m_escapeRadius;
+    const unsigned int iterationMaximum = m_iterationMaximum;
+
+    while (task != -1) {
+        std::size_t begin = static_cast<std::size_t>(task) * length;
+        std::size_t end = std::min(begin + length, m_points.size());
+
+        for (std::size_t i = begin; i < end; i++) {
+            Complex z, c, dz;
+            if constexpr (mandelbrotMode) {
+                z = m_constant;
+                c = m_points[i];
+                dz = Complex(0.0, 0.0);
+            } else {
+                z = m_points[i];
+                c = m_constant;
+                dz = Complex(1.0, 0.0);
+            }
+
+            double magnitudeSquared = z.magnitudeSquared();
+            unsigned int iteration =
+                iterateOrbit<FormulaType, mandelbrotMode, distanceEstimation>(
+                    z, dz, c, 0, iterationMaximum, escapeRadiusSquared,
+                    magnitudeSquared);
+
+            bool isEscaped = magnitudeSquared > escapeRadiusSquared;
+            m_results->escapeIterations[i] = isEscaped ? iteration : 0;
+            m_results->magnitudesSquared[i] = magnitudeSquared;
+            if constexpr (distanceEstimation) {
+                m_results->distances[i] =
+                    isEscaped ? exteriorDistance(magnitudeSquared, dz) : -1.0;
+            }
+        }
+
+        std::tie(task, length) = workQueue.getTask();
+    }
+}
+
+template <typename FormulaType>
+PointSolver::Worker PointSolver::selectChunkIteratorMode() const {
+    if (m_mandelbrotMode) {
+        if (m_distanceEstimation) {
+            return &PointSolver::chunkIterator<FormulaType, true, true>;
+        }
+        return &PointSolver::chunkIterator<FormulaType, true, false>;
+    }
+    if (m_distanceEstimation) {
+        return &PointSolver::chunkIterator<FormulaType, false, true>;
+    }
+    return &PointSolver::chunkIterator<FormulaType, false, false>;
+}
+
+PointSolver::Worker PointSolver::selectChunkIterator() const {
+    switch (m_formula) {
+    case Formula::burningShip:
+        return selectChunkIteratorMode<BurningShipFormula>();
+    case Formula::tricorn:
+        return selectChunkIteratorMode<TricornFormula>();
+    case Formula::multibrot3:
+        return selectChunkIteratorMode<MultibrotFormula<3>>();
+    case Formula::multibrot4:
+        return selectChunkIteratorMode<MultibrotFormula<4>>();
+    case Formula::mandelbrot:
+    default:
+        return selectChunkIteratorMode<MandelbrotFormula>();
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef _MANDELBROTPOINTSOLVER
+#define _MANDELBROTPOINTSOLVER
+
+#include <span>
+#include <vector>
+
+#include "complex.hpp"
+#include "formula.hpp"
+#include "threadconfig.hpp"
+#include "workqueue.hpp"
+
+// Iterates arbitrary batches of points with the solver's kernel, for use
+// outside the viewer, e.g. from libmandelbrot.a (make lib), which doesn't
+// depend on SDL. Points are split into chunks that the configured worker
+// threads take from a work queue.
+// In mandelbrot mode points are values of c, starting from z = constant,
+// in julia mode they are starting values of z, with c = constant.
+// Settings must not change while solve() runs, and an instance solves one
+// batch at a time.
+class PointSolver {
+public:
+    struct Results {
+        // Iteration at which each point escaped, 0 if it didn't escape.
+        std::vector<unsigned int> escapeIterations;
+        // |z|^2 of each point's last iteration.
+        std::vector<double> magnitudesSquared;
+        // Distance estimates in plane units, negative for points that didn't
+        // escape. Empty without distance estimation.
+        std::vector<double> distances;
+    };
+
+    static constexpr unsigned int chunkLength = 4096;
+
+    PointSolver();
+
+    void setFormula(Formula formula);
+    void setFractal(bool mandelbrotMode, Complex constant);
+    void setMaxIterationCount(unsigned int iterationMaximum);
+    void setEscapeRadius(double escapeRadius);
+    void setDistanceEstimation(bool distanceEstimation);
+    void setThreadConfig(const ThreadConfig& config);
+
+    // Resizes results to the number of points and fills them in.
+    void solve(std::span<const Complex> points, Results& results);
+
+private:
+    Formula m_formula;
+    bool m_mandelbrotMode;
+    Complex m_constant;
+    unsigned int m_iterationMaximum;
+    double m_escapeRadius;
+    bool m_distanceEstimation;
+    unsigned int m_threadCount;
+    std::vector<int> m_workerCpus;
+
+    // The current batch.
+    std::span<const Complex> m_points;
+    Results* m_results;
+    WorkQueue workQueue;
+
+    using Worker = void (PointSolver::*)();
+    void runWorkers(Worker worker);
+
+    template <typename FormulaType, bool mandelbrotMode,
+              bool distanceEstimation>
+    void chunkIterator();
+    Worker selectChunkIterator() const;
+    template <typename FormulaType> Worker selectChunkIteratorMode() const;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "poster.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "escapehistogram.hpp"
+#include "grid2d.hpp"
+#include "pngwriter.hpp"
+#include "shading.hpp"
+#include "solver.hpp"
+
+PosterRenderer::PosterRenderer(unsigned int width, unsigned int height,
+                               double viewCenterReal, double viewCenterImag,
+                               double viewScale)
+    : m_width(width), m_height(height), m_viewCenterReal(viewCenterReal),
+      m_viewCenterImag(viewCenterImag), m_viewScale(viewScale) {
+    shading.setShadingFunction(2);
+}
+
+void PosterRenderer::render(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+
+    estimateHistogram();
+
+    PngWriter writer(path, m_width, m_height);
+
+    // Pixels are square and their size only depends on the view scale and the
+    // image width, so each band is a view of the same scale with its centre
+    // shifted down by whole pixels.
+    double pixelSize = 4.0 / (m_viewScale * m_width);
+    unsigned int bandHeight = std::clamp<std::size_t>(bandPixels / m_width, 1,
+                                                      m_height);
+
+    Solver::FrameData frameData;
+    std::vector<unsigned char> pixels;
+
+    for (unsigned int bandStart = 0; bandStart < m_height;
+         bandStart += bandHeight) {
+        unsigned int rowCount = std::min(bandHeight, m_height - bandStart);
+
+        double bandCenterImag =
+            m_viewCenterImag +
+            (0.5 * m_height - bandStart - 0.5 * rowCount) * pixelSize;
+        solver.initializeGrid(m_width, rowCount, m_viewCenterReal,
+                              bandCenterImag, m_viewScale);
+        solver.solve();
+        solver.getFrameData(frameData);
+
+        shadeBand(frameData.smoothIterationGrid, pixels);
+        writer.writeRows(pixels.data(), rowCount);
+
+        std::cout << "poster rows " << bandStart + rowCount << " / "
+                  << m_height << "\n";
+    }
+
+    writer.finish();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "poster written to " << path << " in " << elapsed.count()
+              << " s\n";
+}
+
+void PosterRenderer::estimateHistogram() {
+    // Downscale by a whole factor so the preview covers exactly the same view.
+    std::size_t factor = 1;
+    while ((m_width / factor) * (m_height / factor) > previewPixels) {
+        factor++;
+    }
+    unsigned int previewWidth = std::max<std::size_t>(m_width / factor, 1);
+    unsigned int previewHeight = std::max<std::size_t>(m_height / factor, 1);
+
+    solver.initializeGrid(previewWidth, previewHeight, m_viewCenterReal,
+                          m_viewCenterImag, m_viewScale);
+    solver.solve();
+
+    Solver::FrameData frameData;
+    solver.getFrameData(frameData);
+    escapeHistogram = std::move(frameData.escapeHistogram);
+}
+
+void PosterRenderer::shadeBand(const Grid2d<float>& smoothIterationGrid,
+                               std::vector<unsigned char>& pixels) const {
+    pixels.resize(smoothIterationGrid.size() * 3);
+
+    Shading::Colour background = shading.shade(1.0, 0.0);
+
+    for (std::size_t i = 0; i < smoothIterationGrid.size(); i++) {
+        Shading::Colour colour = background;
+        if (smoothIterationGrid[i] >= 0.0f) {
+            colour = shading.shade(
+                escapeHistogram.fraction(smoothIterationGrid[i] + 5 - 1.0),
+                0.0);
+        }
+        pixels[i * 3] = static_cast<unsigned char>(get<0>(colour));
+        pixels[i * 3 + 1] = static_cast<unsigned char>(get<1>(colour));
+        pixels[i * 3 + 2] = static_cast<unsigned char>(get<2>(colour));
+    }
+}
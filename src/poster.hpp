@@ -0,0 +1,43 @@
+#ifndef _MANDELBROTPOSTER
+#define _MANDELBROTPOSTER
+
+#include <string>
+#include <vector>
+
+#include "escapehistogram.hpp"
+#include "shading.hpp"
+#include "solver.hpp"
+
+// Headless renderer for images too large to hold in memory.
+// The image is solved and shaded a band of rows at a time and streamed to a
+// PNG file. A low resolution preview pass over the whole view provides the
+// escape histogram, so histogram shading is consistent between bands.
+class PosterRenderer {
+public:
+    PosterRenderer(unsigned int width, unsigned int height,
+                   double viewCenterReal, double viewCenterImag,
+                   double viewScale);
+
+    void render(const std::string& path);
+
+private:
+    unsigned int m_width, m_height;
+    double m_viewCenterReal, m_viewCenterImag;
+    double m_viewScale;
+
+    // Upper bounds on the pixel counts of the preview and of each band.
+    static constexpr std::size_t previewPixels = 1 << 20;
+    static constexpr std::size_t bandPixels = 1 << 22;
+
+    Solver solver;
+    Shading shading;
+
+    EscapeHistogram::Table escapeHistogram;
+
+    void estimateHistogram();
+
+    void shadeBand(const Grid2d<float>& smoothIterationGrid,
+                   std::vector<unsigned char>& pixels) const;
+};
+
+#endif
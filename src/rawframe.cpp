@@ -0,0 +1,353 @@
+#include "rawframe.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <zlib.h>
+
+static_assert(std::is_trivially_copyable_v<RawFrame::Header>);
+
+namespace {
+
+constexpr char rawFrameMagic[8] = {'M', 'B', 'X', 'R', 'A', 'W', '\0', '\0'};
+constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+std::size_t padded(std::size_t size) { return (size + 7) & ~std::size_t(7); }
+
+// Lengths of a frame's arrays, in the order they are stored.
+std::array<std::size_t, 3> arrayLengths(const RawFrame::Header& header) {
+    std::size_t pixelCount =
+        static_cast<std::size_t>(header.width) * header.height;
+    return {pixelCount, static_cast<std::size_t>(header.binCount),
+            header.hasDistances ? pixelCount : 0};
+}
+
+std::array<std::size_t, 3> arraySizes(const RawFrame::Header& header) {
+    std::array<std::size_t, 3> sizes = arrayLengths(header);
+    for (std::size_t& size : sizes) {
+        size = padded(size * sizeof(float));
+    }
+    return sizes;
+}
+
+// Compressed arrays are shuffled in blocks of this many floats: the first
+// bytes of every float come first, then the second bytes and so on. Sign,
+// exponent and high mantissa bytes of neighbouring pixels mostly repeat,
+// which deflate only finds once they are next to each other.
+constexpr std::size_t shuffleBlockLength = 1 << 16;
+
+void shuffle(std::span<const float> values, unsigned char* bytes) {
+    const auto* source = reinterpret_cast<const unsigned char*>(values.data());
+    for (std::size_t i = 0; i < values.size(); i++) {
+        for (std::size_t byte = 0; byte < sizeof(float); byte++) {
+            bytes[byte * values.size() + i] = source[i * sizeof(float) + byte];
+        }
+    }
+}
+
+void unshuffle(const unsigned char* bytes, std::span<float> values) {
+    auto* destination = reinterpret_cast<unsigned char*>(values.data());
+    for (std::size_t i = 0; i < values.size(); i++) {
+        for (std::size_t byte = 0; byte < sizeof(float); byte++) {
+            destination[i * sizeof(float) + byte] =
+                bytes[byte * values.size() + i];
+        }
+    }
+}
+
+// Deflates to a file in pieces small enough for zlib's 32 bit lengths.
+class DeflateWriter {
+public:
+    explicit DeflateWriter(std::ofstream& file) : m_file(file), m_stream() {
+        // Smooth iteration counts barely compress past the fastest level.
+        if (deflateInit(&m_stream, Z_BEST_SPEED) != Z_OK) {
+            throw std::runtime_error("could not initialise compression");
+        }
+        m_buffer.resize(1 << 16);
+    }
+    ~DeflateWriter() { deflateEnd(&m_stream); }
+
+    DeflateWriter(const DeflateWriter&) = delete;
+    DeflateWriter& operator=(const DeflateWriter&) = delete;
+
+    void write(const void* data, std::size_t size) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        while (size > 0) {
+            std::size_t length = std::min<std::size_t>(size, 1 << 30);
+            m_stream.next_in = const_cast<unsigned char*>(bytes);
+            m_stream.avail_in = length;
+            deflateInput(Z_NO_FLUSH);
+            bytes += length;
+            size -= length;
+        }
+    }
+
+    void finish() {
+        m_stream.next_in = nullptr;
+        m_stream.avail_in = 0;
+        deflateInput(Z_FINISH);
+    }
+
+private:
+    std::ofstream& m_file;
+    z_stream m_stream;
+    std::vector<unsigned char> m_buffer;
+
+    void deflateInput(int flush) {
+        int result;
+        do {
+            m_stream.next_out = m_buffer.data();
+            m_stream.avail_out = m_buffer.size();
+            result = deflate(&m_stream, flush);
+            if (result == Z_STREAM_ERROR) {
+                throw std::runtime_error("raw frame compression failed");
+            }
+            m_file.write(reinterpret_cast<const char*>(m_buffer.data()),
+                         m_buffer.size() - m_stream.avail_out);
+        } while (m_stream.avail_out == 0 or
+                 (flush == Z_FINISH and result != Z_STREAM_END));
+    }
+};
+
+} // namespace
+
+RawFrame RawFrame::fromFrameData(const Solver::FrameData& frameData,
+                                 int iterationMaximum) {
+    RawFrame frame = {};
+    Header& header = frame.header;
+    header.width = frameData.view.width;
+    header.height = frameData.view.height;
+    header.viewCenterReal = frameData.view.center.real;
+    header.viewCenterImag = frameData.view.center.imag;
+    header.viewScale = frameData.view.scale;
+    header.constantReal = frameData.view.constant.real;
+    header.constantImag = frameData.view.constant.imag;
+    header.formula = static_cast<std::int32_t>(frameData.view.formula);
+    header.mandelbrotMode = frameData.view.mandelbrotMode;
+    header.iterationMaximum = iterationMaximum;
+    header.iterationCount = frameData.iterationCount;
+    header.escapeCount = frameData.escapeCount;
+
+    frame.smoothIterations = frameData.smoothIterationGrid.elements();
+    frame.cumulativeCounts = frameData.escapeHistogram.cumulativeCounts;
+    frame.distances = frameData.distanceGrid.elements();
+    return frame;
+}
+
+void RawFrame::write(const std::string& path, Compression compression) const {
+    std::size_t pixelCount =
+        static_cast<std::size_t>(header.width) * header.height;
+    if (header.width <= 0 or header.height <= 0 or
+        smoothIterations.size() != pixelCount or
+        (!distances.empty() and distances.size() != pixelCount)) {
+        throw std::runtime_error("raw frame arrays don't match its size");
+    }
+
+    Header fileHeader = header;
+    std::memcpy(fileHeader.magic, rawFrameMagic, sizeof(rawFrameMagic));
+    fileHeader.version = currentVersion;
+    fileHeader.byteOrder = byteOrderMark;
+    fileHeader.hasDistances = !distances.empty();
+    fileHeader.compression = compression;
+    fileHeader.binCount = static_cast<std::int32_t>(cumulativeCounts.size());
+    auto sizes = arraySizes(fileHeader);
+    fileHeader.payloadSize = sizes[0] + sizes[1] + sizes[2];
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("could not open " + temporaryPath);
+        }
+
+        static constexpr char padding[8] = {};
+        file.write(reinterpret_cast<const char*>(&fileHeader),
+                   sizeof(fileHeader));
+        file.write(padding, padded(sizeof(fileHeader)) - sizeof(fileHeader));
+
+        std::array<std::span<const float>, 3> arrays = {
+            smoothIterations, cumulativeCounts, distances};
+        if (compression == Compression::zlib) {
+            DeflateWriter writer(file);
+            std::vector<unsigned char> shuffled(shuffleBlockLength *
+                                                sizeof(float));
+            for (std::size_t i = 0; i < arrays.size(); i++) {
+                for (std::size_t begin = 0; begin < arrays[i].size();
+                     begin += shuffleBlockLength) {
+                    std::span<const float> block = arrays[i].subspan(
+                        begin, std::min(shuffleBlockLength,
+                                        arrays[i].size() - begin));
+                    shuffle(block, shuffled.data());
+                    writer.write(shuffled.data(), block.size_bytes());
+                }
+                writer.write(padding, sizes[i] - arrays[i].size_bytes());
+            }
+            writer.finish();
+        } else {
+            for (std::size_t i = 0; i < arrays.size(); i++) {
+                file.write(reinterpret_cast<const char*>(arrays[i].data()),
+                           arrays[i].size_bytes());
+                file.write(padding, sizes[i] - arrays[i].size_bytes());
+            }
+        }
+
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("could not write " + temporaryPath);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        throw std::runtime_error("could not replace " + path + ": " +
+                                 error.message());
+    }
+}
+
+RawFrameFile::RawFrameFile(const std::string& path) : m_file(path) {
+    auto invalid = [&path](const std::string& reason) {
+        return std::runtime_error(path + " is not a valid raw frame: " +
+                                  reason);
+    };
+
+    if (m_file.size() < sizeof(RawFrame::Header) or
+        std::memcmp(m_file.data(), rawFrameMagic, sizeof(rawFrameMagic)) !=
+            0) {
+        throw invalid("bad magic");
+    }
+    const RawFrame::Header& fileHeader = header();
+    if (fileHeader.version != RawFrame::currentVersion) {
+        throw invalid("version " + std::to_string(fileHeader.version) +
+                      ", expected " + std::to_string(RawFrame::currentVersion));
+    }
+    if (fileHeader.byteOrder != byteOrderMark) {
+        throw invalid("written with a different byte order");
+    }
+    if (fileHeader.width <= 0 or fileHeader.height <= 0 or
+        fileHeader.binCount < 0 or fileHeader.iterationMaximum <= 0 or
+        fileHeader.escapeCount < 0) {
+        throw invalid("bad dimensions");
+    }
+
+    auto sizes = arraySizes(fileHeader);
+    std::size_t payloadSize = sizes[0] + sizes[1] + sizes[2];
+    if (fileHeader.payloadSize != payloadSize) {
+        throw invalid("bad payload size");
+    }
+    m_cumulativeCountsOffset = sizes[0];
+    m_distancesOffset = sizes[0] + sizes[1];
+
+    std::size_t payloadOffset = padded(sizeof(RawFrame::Header));
+    switch (fileHeader.compression) {
+    case RawFrame::Compression::none:
+        if (m_file.size() != payloadOffset + payloadSize) {
+            throw invalid("truncated");
+        }
+        m_payload = m_file.data() + payloadOffset;
+        break;
+    case RawFrame::Compression::zlib: {
+        m_inflated.resize(payloadSize);
+        const unsigned char* in = m_file.data() + payloadOffset;
+        const unsigned char* inEnd = m_file.data() + m_file.size();
+        unsigned char* out = m_inflated.data();
+        unsigned char* outEnd = out + m_inflated.size();
+
+        z_stream stream = {};
+        if (inflateInit(&stream) != Z_OK) {
+            throw std::runtime_error("could not initialise decompression");
+        }
+        int result = Z_OK;
+        while (result == Z_OK) {
+            // zlib's lengths are 32 bits, large files are passed in pieces.
+            if (stream.avail_in == 0) {
+                stream.next_in = const_cast<unsigned char*>(in);
+                stream.avail_in = std::min<std::size_t>(inEnd - in, 1 << 30);
+                in += stream.avail_in;
+            }
+            if (stream.avail_out == 0) {
+                stream.next_out = out;
+                stream.avail_out = std::min<std::size_t>(outEnd - out, 1 << 30);
+                out += stream.avail_out;
+            }
+            result = inflate(&stream, Z_NO_FLUSH);
+        }
+        bool isComplete = result == Z_STREAM_END and in == inEnd and
+                          stream.avail_in == 0 and out == outEnd and
+                          stream.avail_out == 0;
+        inflateEnd(&stream);
+        if (!isComplete) {
+            throw invalid("bad compressed data");
+        }
+
+        std::vector<unsigned char> shuffled(shuffleBlockLength *
+                                            sizeof(float));
+        std::size_t offset = 0;
+        auto lengths = arrayLengths(fileHeader);
+        for (std::size_t i = 0; i < lengths.size(); i++) {
+            auto* values = reinterpret_cast<float*>(m_inflated.data() + offset);
+            for (std::size_t begin = 0; begin < lengths[i];
+                 begin += shuffleBlockLength) {
+                std::span<float> block(
+                    values + begin,
+                    std::min(shuffleBlockLength, lengths[i] - begin));
+                std::memcpy(shuffled.data(), block.data(), block.size_bytes());
+                unshuffle(shuffled.data(), block);
+            }
+            offset += sizes[i];
+        }
+        m_payload = m_inflated.data();
+        break;
+    }
+    default:
+        throw invalid("unknown compression");
+    }
+
+    // Colours are scaled by the table's total, which is the escape count
+    // rounded to a float.
+    std::span<const float> counts = cumulativeCounts();
+    float tableCount = counts.empty() ? 0.0f : counts.back();
+    if (tableCount != static_cast<float>(fileHeader.escapeCount)) {
+        throw invalid("escape histogram doesn't add up to the escape count");
+    }
+}
+
+const RawFrame::Header& RawFrameFile::header() const {
+    return *reinterpret_cast<const RawFrame::Header*>(m_file.data());
+}
+
+std::span<const float> RawFrameFile::smoothIterations() const {
+    return {reinterpret_cast<const float*>(m_payload),
+            static_cast<std::size_t>(header().width) * header().height};
+}
+
+std::span<const float> RawFrameFile::cumulativeCounts() const {
+    return {reinterpret_cast<const float*>(m_payload +
+                                           m_cumulativeCountsOffset),
+            static_cast<std::size_t>(header().binCount)};
+}
+
+std::span<const float> RawFrameFile::distances() const {
+    if (!header().hasDistances) {
+        return {};
+    }
+    return {reinterpret_cast<const float*>(m_payload + m_distancesOffset),
+            static_cast<std::size_t>(header().width) * header().height};
+}
+
+EscapeHistogram::Table RawFrameFile::escapeHistogram() const {
+    EscapeHistogram::Table table;
+    std::span<const float> counts = cumulativeCounts();
+    table.cumulativeCounts.assign(counts.begin(), counts.end());
+    float escapeCount = counts.empty() ? 0.0f : counts.back();
+    table.scale = escapeCount > 0.0f ? 1.0f / escapeCount : 0.0f;
+    return table;
+}
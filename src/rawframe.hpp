@@ -0,0 +1,98 @@
+#ifndef _MANDELBROTRAWFRAME
+#define _MANDELBROTRAWFRAME
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "escapehistogram.hpp"
+#include "mappedfile.hpp"
+#include "solver.hpp"
+
+// A finished escape time frame before shading, so it can be coloured again
+// later without iterating. Stored as a versioned binary file like checkpoints:
+// the header followed by the arrays in the order below, each padded to 8
+// bytes, in the byte order of the machine that wrote it. Compressed files
+// store the arrays as one zlib stream instead, with the bytes of each float
+// array grouped by their position in the float, which has to be inflated to be
+// read. Uncompressed files are memory mapped.
+struct RawFrame {
+    enum class Compression : std::int32_t {
+        none,
+        zlib,
+    };
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+
+        std::int32_t width, height;
+        double viewCenterReal, viewCenterImag, viewScale;
+        double constantReal, constantImag;
+        std::int32_t formula;
+        std::int32_t mandelbrotMode;
+        std::int32_t iterationMaximum;
+        std::int32_t iterationCount;
+        std::int32_t escapeCount;
+        std::int32_t hasDistances;
+        Compression compression;
+        std::int32_t binCount;
+        // Size of the arrays before compression.
+        std::uint64_t payloadSize;
+    };
+
+    Header header;
+    // Continuous escape iteration count of each pixel, negative for pixels
+    // that didn't escape, row by row.
+    std::span<const float> smoothIterations;
+    // The escape histogram's table.
+    std::span<const float> cumulativeCounts;
+    // Distance estimates in pixels, or empty.
+    std::span<const float> distances;
+
+    static constexpr std::uint32_t currentVersion = 1;
+    static constexpr std::string_view extension = ".mbraw";
+
+    // Refers to the frame's grids, which must outlive it.
+    static RawFrame fromFrameData(const Solver::FrameData& frameData,
+                                  int iterationMaximum);
+
+    // Writes to a temporary file next to path and renames it over path.
+    // Throws std::runtime_error if the file can't be written.
+    void write(const std::string& path, Compression compression) const;
+};
+
+// Read-only view of a raw frame file.
+class RawFrameFile {
+public:
+    // Throws std::runtime_error if the file can't be read or isn't a raw
+    // frame of the current version.
+    explicit RawFrameFile(const std::string& path);
+
+    RawFrameFile(const RawFrameFile&) = delete;
+    RawFrameFile& operator=(const RawFrameFile&) = delete;
+
+    const RawFrame::Header& header() const;
+    std::span<const float> smoothIterations() const;
+    std::span<const float> cumulativeCounts() const;
+    // Empty if the frame has no distance estimates.
+    std::span<const float> distances() const;
+
+    // The stored table, normalised by its escape count.
+    EscapeHistogram::Table escapeHistogram() const;
+
+private:
+    MappedFile m_file;
+    // Inflated arrays of a compressed file.
+    std::vector<unsigned char> m_inflated;
+    // Start of the arrays, in the file or in m_inflated.
+    const unsigned char* m_payload;
+    std::size_t m_cumulativeCountsOffset;
+    std::size_t m_distancesOffset;
+};
+
+#endif
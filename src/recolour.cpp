@@ -0,0 +1,141 @@
+#include "recolour.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "escapehistogram.hpp"
+#include "pngwriter.hpp"
+#include "rawframe.hpp"
+#include "shading.hpp"
+#include "trace.hpp"
+
+Recolourer::Recolourer(unsigned int workerCount, int shadingFunction)
+    : m_workerCount(std::max(workerCount, 1u)),
+      m_shadingFunction(shadingFunction) {}
+
+void Recolourer::recolour(const std::vector<Job>& jobs) {
+    if (jobs.empty()) {
+        return;
+    }
+    unsigned int fileWorkerCount =
+        std::min<std::size_t>(m_workerCount, jobs.size());
+    unsigned int threadsPerFile = m_workerCount / fileWorkerCount;
+
+    std::atomic_size_t nextJob = 0;
+    std::string error;
+    std::mutex errorMutex;
+
+    auto workLoop = [&]() {
+        Trace::setThreadName("recolour worker");
+        for (std::size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+            try {
+                RawFrameFile frame(jobs[i].input);
+                recolour(frame, jobs[i].output, threadsPerFile);
+            } catch (const std::exception& exception) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (error.empty()) {
+                    error = exception.what();
+                }
+            }
+        }
+    };
+
+    if (fileWorkerCount == 1) {
+        workLoop();
+    } else {
+        std::vector<std::jthread> workers;
+        for (unsigned int i = 0; i < fileWorkerCount; i++) {
+            workers.emplace_back(workLoop);
+        }
+    }
+
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+void Recolourer::recolour(const RawFrameFile& frame, const std::string& output,
+                          unsigned int threadCount) const {
+    TRACE_SCOPE("recolour");
+    Shading shading;
+    shading.setShadingFunction(m_shadingFunction);
+    const Shading::Colour background = shading.shade(1.0, 0.0);
+    const EscapeHistogram::Table escapeHistogram = frame.escapeHistogram();
+
+    const int width = frame.header().width;
+    const int height = frame.header().height;
+    std::span<const float> smoothIterations = frame.smoothIterations();
+    std::span<const float> distances = frame.distances();
+
+    // Same colours as the viewer and batch renders, at time zero.
+    auto shadeRows = [&](int firstRow, int rowCount, unsigned char* pixels) {
+        std::size_t begin = static_cast<std::size_t>(firstRow) * width;
+        std::size_t end = begin + static_cast<std::size_t>(rowCount) * width;
+        for (std::size_t i = begin; i < end; i++) {
+            Shading::Colour colour = background;
+            if (smoothIterations[i] >= 0.0f) {
+                float factor =
+                    escapeHistogram.fraction(smoothIterations[i] + 4.0);
+                colour = distances.empty()
+                             ? shading.shade(factor, 0.0)
+                             : shading.shadeWithDistance(factor, distances[i],
+                                                         0.0);
+            }
+            unsigned char* pixel = pixels + (i - begin) * 3;
+            pixel[0] = static_cast<unsigned char>(get<0>(colour));
+            pixel[1] = static_cast<unsigned char>(get<1>(colour));
+            pixel[2] = static_cast<unsigned char>(get<2>(colour));
+        }
+    };
+
+    PngWriter writer(output, width, height);
+    std::vector<unsigned char> pixels(static_cast<std::size_t>(bandRows) *
+                                      width * 3);
+    const unsigned int threads =
+        std::min<unsigned int>(threadCount, std::min(bandRows, height));
+
+    // The threads are started once per file, each shades its share of every
+    // band's rows and the last to finish a band writes it.
+    int firstRow = 0;
+    std::exception_ptr error;
+    auto writeBand = [&]() noexcept {
+        try {
+            writer.writeRows(pixels.data(),
+                             std::min(bandRows, height - firstRow));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        firstRow += bandRows;
+    };
+    std::barrier bandShaded(threads, writeBand);
+    auto shadeBands = [&](unsigned int thread) {
+        while (firstRow < height and !error) {
+            int rowCount = std::min(bandRows, height - firstRow);
+            int begin = rowCount * thread / threads;
+            int end = rowCount * (thread + 1) / threads;
+            shadeRows(firstRow + begin, end - begin,
+                      pixels.data() +
+                          static_cast<std::size_t>(begin) * width * 3);
+            bandShaded.arrive_and_wait();
+        }
+    };
+    {
+        std::vector<std::jthread> workers;
+        for (unsigned int i = 1; i < threads; i++) {
+            workers.emplace_back(shadeBands, i);
+        }
+        shadeBands(0);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    writer.finish();
+}
@@ -0,0 +1,38 @@
+#ifndef _MANDELBROTRECOLOUR
+#define _MANDELBROTRECOLOUR
+
+#include <string>
+#include <vector>
+
+#include "rawframe.hpp"
+
+// Shades raw frame files to PNG with any shading function, without iterating
+// again. Files are shared out between workers, and workers left without a
+// file of their own help shade the rows of the others, so a single large
+// frame still uses every worker. Frames with distance estimates are shaded
+// with them, as in the viewer.
+class Recolourer {
+public:
+    struct Job {
+        std::string input, output;
+    };
+
+    // Rows shaded at a time, between writes.
+    static constexpr int bandRows = 64;
+
+    Recolourer(unsigned int workerCount, int shadingFunction);
+
+    // Throws std::runtime_error with the first error once every job that can
+    // be written has been.
+    void recolour(const std::vector<Job>& jobs);
+
+    // Shades a frame and writes it to output using threadCount threads.
+    void recolour(const RawFrameFile& frame, const std::string& output,
+                  unsigned int threadCount) const;
+
+private:
+    unsigned int m_workerCount;
+    int m_shadingFunction;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "shading.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <utility>
 #include <vector>
@@ -19,6 +20,21 @@ Shading::Colour Shading::shade(double histogramFactor,
     return (this->*shadingFunction)(histogramFactor, timeCounter);
 }
 
+Shading::Colour Shading::shadeSmooth(double smoothIterationCount,
+                                     double timeCounter) const {
+    return shade(1.0 - std::exp(-smoothIterationCount / 64.0), timeCounter);
+}
+
+Shading::Colour Shading::shadeWithDistance(double colourFactor,
+                                           double distance,
+                                           double timeCounter) const {
+    auto [red, green, blue] = shade(colourFactor, timeCounter);
+    double brightness = std::tanh(std::max(distance, 0.0));
+    return {static_cast<int>(red * brightness),
+            static_cast<int>(green * brightness),
+            static_cast<int>(blue * brightness)};
+}
+
 void Shading::setShadingFunction(int functionNumber) {
     switch (functionNumber) {
     case 0:
@@ -39,6 +55,10 @@ void Shading::setShadingFunction(int functionNumber) {
     }
 }
 
+bool Shading::isAnimated() const {
+    return shadingFunction == &Shading::shadeHsv;
+}
+
 Shading::Colour Shading::shadeGreyscale(double histogramFactor,
                                         double timeCounter) const {
     return shadeGreyscaleInverse(1.0 - histogramFactor, timeCounter);
@@ -17,9 +17,20 @@ public:
     Shading();
 
     Colour shade(double colourFactor, double timeCounter) const;
+    // Shades by a continuous escape iteration count alone. Unlike histogram
+    // shading this doesn't depend on the rest of the image, so separately
+    // rendered images match.
+    Colour shadeSmooth(double smoothIterationCount, double timeCounter) const;
+    // Darkens a colour factor's colour towards the boundary of the set, by
+    // the estimated distance to it in pixels, which outlines thin filaments.
+    Colour shadeWithDistance(double colourFactor, double distance,
+                             double timeCounter) const;
 
     void setShadingFunction(int functionNumber);
 
+    // Whether the current shading function changes with time.
+    bool isAnimated() const;
+
 private:
     ShadingFunction shadingFunction;
 
@@ -1,20 +1,37 @@
 #include "solver.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
+#include "checkpoint.hpp"
 #include "complex.hpp"
+#include "escapehistogram.hpp"
+#include "formula.hpp"
 #include "grid2d.hpp"
+#include "threadconfig.hpp"
+#include "trace.hpp"
 #include "workqueue.hpp"
 
 Solver::Solver() {
+    isRunning = false;
+    m_isWakeRequested = false;
+    m_verbose = true;
     m_iterationCount = 0;
+    m_frameVersion = 0;
+    m_submittedCommandCount = 0;
+    m_appliedCommandCount = 0;
     m_iterationMaximum = 8192;
     m_escapeRadius = 256.0;
     m_width = 1;
@@ -25,145 +42,710 @@ Solver::Solver() {
 
     m_currentFractal = true;
     m_fractalConstant = {0.0, 0.0};
+    m_formula = Formula::mandelbrot;
+
+    m_symmetryEnabled = true;
+    m_symmetry = Symmetry::none;
+    m_mirrorColumn = 0;
+    m_mirrorRow = 0;
+
+    m_peakMemory = 0;
+
+    m_scheduling = Scheduling::uniform;
+    m_focusX = -1.0f;
+    m_focusY = -1.0f;
+    m_passHasDeadline = false;
+    m_tileColumns = 1;
+
+    m_renderMode = RenderMode::escapeTime;
+    m_nextDensityShard = 0;
+    m_sampleCount = 0;
+
+    m_distanceEstimation = false;
+    m_isBoundaryRefined = false;
+    m_refinementSampleCount = 0;
+
+    m_checkpointInterval = std::chrono::seconds(0);
+    m_checkpointFrameVersion = 0;
+
+    m_threadCount = ThreadConfig::current().threadCount();
+    m_workerCpus = ThreadConfig::current().workerCpus();
 }
 
 void Solver::initializeGrid(int width, int height, double viewCenterReal,
                             double viewCenterImag, double viewScale) {
-    {
-        std::lock_guard<std::mutex> lock(calculationMutex);
-
-        m_viewCenter = {viewCenterReal, viewCenterImag};
-        m_viewScale = viewScale;
-    }
+    submit({.type = Command::Type::setView,
+            .real = viewCenterReal,
+            .imag = viewCenterImag,
+            .factor = viewScale});
 
     resizeGrid(width, height);
 }
 
 void Solver::resizeGrid(int width, int height) {
-    std::lock_guard<std::mutex> lock(calculationMutex);
+    submit({.type = Command::Type::resize, .x = width, .y = height});
+}
 
-    m_width = width;
-    m_height = height;
+void Solver::resetGrid() {
+    TRACE_SCOPE("reset grid");
+    m_smoothIterationGrid.resize(m_width, m_height);
 
-    aspectRatio = static_cast<double>(m_width) / static_cast<double>(m_height);
+    m_sampleCount = 0;
+    m_isBoundaryRefined = false;
+    m_refinementSampleCount = 0;
+    if (m_distanceEstimation and m_renderMode == RenderMode::escapeTime) {
+        m_distanceGrid.resize(m_width, m_height);
+        m_distanceGrid.fill(liveValue);
+    } else {
+        m_distanceGrid.resize(0, 0);
+    }
 
-    resetGrid();
-}
+    m_densityMaxima = {};
+    if (m_renderMode == RenderMode::escapeTime) {
+        m_densityShards.clear();
+        for (auto& grid : m_densityGrids) {
+            grid.resize(0, 0);
+        }
+        resetLivePool();
+    } else {
+        // Nothing escapes in the density modes, the live pool stays empty.
+        m_smoothIterationGrid.fill(liveValue);
+        m_liveValues.clear();
+        m_liveIndices.clear();
+        m_liveIterations.clear();
+        m_liveDerivatives.clear();
 
-void Solver::resetGrid() {
+        m_densityShards.resize(std::max(m_threadCount, 1u));
+        for (auto& shard : m_densityShards) {
+            for (auto& grid : shard) {
+                grid.resize(m_width, m_height);
+                grid.fill(0);
+            }
+        }
+        for (auto& grid : m_densityGrids) {
+            grid.resize(m_width, m_height);
+            grid.fill(0);
+        }
+    }
+
+    m_escapeCount = 0;
+    m_escapeHistogram.reset(m_iterationMaximum);
+
+    m_iterationCount = 0;
+
+    // No pass has completed since the reset.
     workQueue.abortIteration();
+    m_frameVersion++;
 
-    m_grid.resize(m_width, m_height);
-    if (m_currentFractal) {
-        m_grid.assign(m_width, m_height, m_fractalConstant);
-    } else {
-        for (int y = 0; y < m_height; y++) {
-            for (int x = 0; x < m_width; x++) {
-                m_grid[x, y] = mapToComplex(x, y);
+    m_peakMemory = std::max(m_peakMemory, memoryUsage());
+}
+
+void Solver::resetLivePool() {
+    detectSymmetry();
+
+    // The pool is laid out tile by tile, so each chunk of it covers a compact
+    // area of the screen which the foveated scheduling can prioritise.
+    // Count live pixels of every tile so each tile knows where its pixels go in
+    // the pool, then fill the pool, both over tiles on the worker threads.
+    m_tileColumns = (m_width + tileSize - 1) / tileSize;
+    int tileCount = m_tileColumns * ((m_height + tileSize - 1) / tileSize);
+    m_tileLiveOffsets.assign(tileCount + 1, 0);
+
+    workQueue.setTaskCount(tileCount);
+    workQueue.setTaskLength(tileSize);
+    runWorkers(&Solver::countLiveTiles);
+
+    for (int tile = 0; tile < tileCount; tile++) {
+        m_tileLiveOffsets[tile + 1] += m_tileLiveOffsets[tile];
+    }
+    std::size_t liveCount = m_tileLiveOffsets[tileCount];
+
+    m_liveValues.resize(liveCount);
+    m_liveIndices.resize(liveCount);
+    m_liveIterations.resize(liveCount);
+    m_liveDerivatives.resize(m_distanceEstimation ? liveCount : 0);
+
+    workQueue.setTaskCount(tileCount);
+    runWorkers(&Solver::fillLiveTiles);
+
+    if (liveCount * 2 < m_liveValues.capacity()) {
+        m_liveValues.shrink_to_fit();
+        m_liveIndices.shrink_to_fit();
+        m_liveIterations.shrink_to_fit();
+        m_liveDerivatives.shrink_to_fit();
+    }
+}
+
+void Solver::countLiveTiles() {
+    auto [tile, length] = workQueue.getTask();
+
+    unsigned int mirrorIndex;
+
+    while (tile != -1) {
+        int tileX = (tile % m_tileColumns) * tileSize;
+        int tileY = (tile / m_tileColumns) * tileSize;
+
+        int tileWidth = std::min(tileSize, m_width - tileX);
+
+        std::size_t liveCount = 0;
+        for (int y = tileY; y < std::min(tileY + tileSize, m_height); y++) {
+            std::ranges::fill(
+                m_smoothIterationGrid.row(y).subspan(tileX, tileWidth),
+                liveValue);
+
+            for (int x = tileX; x < tileX + tileWidth; x++) {
+                unsigned int index = y * m_width + x;
+
+                // Pixels whose mirror image comes first are filled in by that
+                // pixel.
+                if (!mirrorOf(index, mirrorIndex) or mirrorIndex > index) {
+                    liveCount++;
+                }
             }
         }
+        m_tileLiveOffsets[tile + 1] = liveCount;
+
+        std::tie(tile, length) = workQueue.getTask();
     }
+}
 
-    m_iterationGrid.resize(m_width, m_height);
-    m_iterationGrid.assign(m_width, m_height, 0);
+void Solver::fillLiveTiles() {
+    auto [tile, length] = workQueue.getTask();
 
-    m_magnitudeSquaredGrid.resize(m_width, m_height);
-    m_magnitudeSquaredGrid.assign(m_width, m_height, 0.0);
+    unsigned int mirrorIndex;
 
-    m_escapeCount = 0;
-    escapeIterationCounter.resize(m_iterationMaximum);
-    escapeIterationCounter.assign(m_iterationMaximum, 0);
+    while (tile != -1) {
+        int tileX = (tile % m_tileColumns) * tileSize;
+        int tileY = (tile / m_tileColumns) * tileSize;
 
-    m_iterationCount = 0;
+        std::size_t i = m_tileLiveOffsets[tile];
+        for (int y = tileY; y < std::min(tileY + tileSize, m_height); y++) {
+            for (int x = tileX; x < std::min(tileX + tileSize, m_width); x++) {
+                unsigned int index = y * m_width + x;
+                if (mirrorOf(index, mirrorIndex) and mirrorIndex < index) {
+                    continue;
+                }
+                m_liveIndices[i] = index;
+                m_liveIterations[i] = 0;
+                if (m_currentFractal) {
+                    m_liveValues[i] = m_fractalConstant;
+                } else {
+                    m_liveValues[i] = mapToComplex(x, y);
+                }
+                if (m_distanceEstimation) {
+                    // dz/dc starts at 0 for mandelbrot sets, dz/dz0 at 1 for
+                    // julia sets.
+                    m_liveDerivatives[i] = m_currentFractal
+                                               ? Complex(0.0, 0.0)
+                                               : Complex(1.0, 0.0);
+                }
+                i++;
+            }
+        }
+
+        std::tie(tile, length) = workQueue.getTask();
+    }
 }
 
-void Solver::toggleJulia() {
-    std::lock_guard<std::mutex> lock(calculationMutex);
+void Solver::toggleJulia() { submit({.type = Command::Type::toggleJulia}); }
+
+void Solver::setFractal(bool mandelbrotMode, double constantReal,
+                        double constantImag) {
+    submit({.type = Command::Type::setFractal,
+            .real = constantReal,
+            .imag = constantImag,
+            .x = mandelbrotMode});
+}
+
+void Solver::setFormula(Formula formula) {
+    submit({.type = Command::Type::setFormula, .formula = formula});
+}
+
+void Solver::nextFormula() { submit({.type = Command::Type::nextFormula}); }
+
+void Solver::setRenderMode(RenderMode renderMode) {
+    submit({.type = Command::Type::setRenderMode, .renderMode = renderMode});
+}
+
+void Solver::nextRenderMode() {
+    submit({.type = Command::Type::nextRenderMode});
+}
+
+void Solver::submit(const Command& command) {
+    while (!commandQueue.push(command)) {
+        std::this_thread::yield();
+    }
+    m_submittedCommandCount++;
+
+    // Cut the current pass short, its results would be thrown away anyway.
+    workQueue.abortIteration();
+    wake();
+}
+
+void Solver::processCommands() {
+    if (commandQueue.empty()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(calculationMutex, std::defer_lock);
+    {
+        TRACE_SCOPE("command lock wait");
+        lock.lock();
+    }
+    TRACE_SCOPE("apply commands");
 
-    if (m_currentFractal) { // Switch to julia set.
-        std::cout << "Switching to julia set.\n";
-    } else { // Switch to mandelbrot set.
-        std::cout << "Switching to mandelbrot set.\n";
+    Command command;
+    while (commandQueue.pop(command)) {
+        applyCommand(command);
+        m_appliedCommandCount++;
     }
-    std::swap(m_viewCenter, m_fractalConstant);
-    m_currentFractal = !m_currentFractal;
 
     resetGrid();
+    if (m_verbose) {
+        printLocation();
+    }
+}
+
+void Solver::applyCommand(const Command& command) {
+    switch (command.type) {
+    case Command::Type::setView:
+        m_viewCenter = {command.real, command.imag};
+        m_viewScale = command.factor;
+        break;
+    case Command::Type::resize:
+        m_width = command.x;
+        m_height = command.y;
+        aspectRatio =
+            static_cast<double>(m_width) / static_cast<double>(m_height);
+        break;
+    case Command::Type::zoom:
+        m_viewScale *= command.factor;
+        break;
+    case Command::Type::zoomOnPixel:
+        m_viewCenter = mapToComplex(command.x, command.y);
+        m_viewScale *= command.factor;
+        break;
+    case Command::Type::move:
+        m_viewCenter +=
+            Complex(command.real / m_viewScale, command.imag / m_viewScale);
+        break;
+    case Command::Type::toggleJulia:
+        if (m_verbose) {
+            std::cout << "Switching to "
+                      << (m_currentFractal ? "julia" : "mandelbrot")
+                      << " set.\n";
+        }
+        std::swap(m_viewCenter, m_fractalConstant);
+        m_currentFractal = !m_currentFractal;
+        break;
+    case Command::Type::setFractal:
+        m_currentFractal = command.x;
+        m_fractalConstant = {command.real, command.imag};
+        break;
+    case Command::Type::setFormula:
+        m_formula = command.formula;
+        break;
+    case Command::Type::nextFormula:
+        m_formula = static_cast<Formula>((static_cast<int>(m_formula) + 1) %
+                                         formulaCount);
+        if (m_verbose) {
+            std::cout << "Switching to " << formulaName(m_formula)
+                      << " formula.\n";
+        }
+        break;
+    case Command::Type::setRenderMode:
+        m_renderMode = command.renderMode;
+        break;
+    case Command::Type::setMaxIterationCount:
+        m_iterationMaximum = command.x;
+        break;
+    case Command::Type::setSymmetryEnabled:
+        m_symmetryEnabled = command.x;
+        break;
+    case Command::Type::setDistanceEstimation:
+        m_distanceEstimation = command.x;
+        break;
+    case Command::Type::toggleDistanceEstimation:
+        m_distanceEstimation = !m_distanceEstimation;
+        if (m_verbose) {
+            std::cout << "Distance estimation "
+                      << (m_distanceEstimation ? "on" : "off") << ".\n";
+        }
+        break;
+    case Command::Type::nextRenderMode:
+        m_renderMode = static_cast<RenderMode>(
+            (static_cast<int>(m_renderMode) + 1) % renderModeCount);
+        if (m_verbose) {
+            std::cout << "Switching to "
+                      << (m_renderMode == RenderMode::escapeTime ? "escape time"
+                          : m_renderMode == RenderMode::buddhabrot
+                              ? "buddhabrot"
+                              : "anti-buddhabrot")
+                      << " rendering.\n";
+        }
+        break;
+    }
 }
 
 void Solver::calculationLoop() {
+    Trace::setThreadName("solver");
     isRunning = true;
+    unsigned long notifiedVersion = 0;
     while (isRunning) {
+        // Yield between passes so getFrameData can take the mutex.
+        std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+        processCommands();
         iterateGrid();
+        checkpointIfDue();
+
+        if (m_frameVersion != notifiedVersion) {
+            notifiedVersion = m_frameVersion;
+            if (m_onFrame) {
+                m_onFrame();
+            }
+        }
+
+        bool isIdle;
+        {
+            std::lock_guard<std::mutex> lock(calculationMutex);
+            isIdle = isFinished() and commandQueue.empty();
+        }
+        if (isIdle) {
+            waitForWork();
+        }
     }
 }
 
-void Solver::stop() { isRunning = false; }
+void Solver::setFrameCallback(std::function<void()> onFrame) {
+    m_onFrame = std::move(onFrame);
+}
 
-int Solver::getMaxIterationCount() { return m_iterationMaximum; }
+void Solver::wake() {
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_isWakeRequested = true;
+    }
+    m_wakeCondition.notify_one();
+}
 
-void Solver::getFrameData(int& iterationCount, int& escapeCount,
-                          Grid2d<double>& magnitudeSquaredGrid,
-                          Grid2d<int>& iterationGrid,
-                          std::vector<int>& escapeIterationCounterSums) {
+void Solver::waitForWork() {
+    TRACE_SCOPE("idle");
 
-    while (m_iterationCount == 0) [[unlikely]] {
+    bool isCheckpointPending;
+    std::chrono::steady_clock::time_point checkpointDue;
+    {
+        std::lock_guard<std::mutex> lock(calculationMutex);
+        // Also false in states checkpointIfDue skips, where waking for it
+        // would spin.
+        isCheckpointPending = isCheckpointDue();
+        checkpointDue = m_lastCheckpoint + m_checkpointInterval;
     }
 
-    // Loop to keep acquiring mutex until it is acquired after the completion of
-    // a non-aborted iteration.
-    bool done = false;
-    while (!done) {
-        std::lock_guard<std::mutex> lock(calculationMutex);
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    auto isWoken = [this] { return m_isWakeRequested or !isRunning; };
+    if (isCheckpointPending) {
+        m_wakeCondition.wait_until(lock, checkpointDue, isWoken);
+    } else {
+        m_wakeCondition.wait(lock, isWoken);
+    }
+    m_isWakeRequested = false;
+}
 
-        if (!workQueue.isAborted()) [[likely]] {
-            iterationCount = m_iterationCount;
+void Solver::setSymmetryEnabled(bool enabled) {
+    submit({.type = Command::Type::setSymmetryEnabled, .x = enabled});
+}
 
-            escapeCount = m_escapeCount;
+void Solver::setDistanceEstimation(bool enabled) {
+    submit({.type = Command::Type::setDistanceEstimation, .x = enabled});
+}
 
-            magnitudeSquaredGrid = m_magnitudeSquaredGrid;
+void Solver::toggleDistanceEstimation() {
+    submit({.type = Command::Type::toggleDistanceEstimation});
+}
 
-            iterationGrid = m_iterationGrid;
+bool Solver::getDistanceEstimation() const { return m_distanceEstimation; }
 
-            escapeIterationCounterSums.resize(m_iterationMaximum);
-            escapeIterationCounterSums[0] = escapeIterationCounter[0];
-            for (int i = 1; i < m_iterationMaximum; i++) {
-                escapeIterationCounterSums[i] =
-                    escapeIterationCounterSums[i - 1] +
-                    escapeIterationCounter[i];
-            }
+void Solver::setScheduling(Scheduling scheduling) {
+    m_scheduling = scheduling;
+}
+
+Solver::Scheduling Solver::getScheduling() const { return m_scheduling; }
+
+void Solver::setFocus(float x, float y) {
+    m_focusX = x;
+    m_focusY = y;
+}
+
+void Solver::setThreadConfig(const ThreadConfig& config) {
+    std::lock_guard<std::mutex> lock(calculationMutex);
+
+    m_threadCount = config.threadCount();
+    m_workerCpus = config.workerCpus();
+}
+
+void Solver::solve() {
+    processCommands();
+
+    while (!isFinished()) {
+        iterateGrid();
+    }
+}
 
-            done = true;
+bool Solver::solveFor(std::chrono::nanoseconds budget) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    processCommands();
+
+    while (!isFinished()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
         }
+        iterateGrid();
     }
+    return true;
 }
 
-void Solver::zoomIn(double factor) {
+void Solver::stop() {
+    isRunning = false;
+
+    // Taking the mutex orders this with getFrameData checking isRunning.
+    { std::lock_guard<std::mutex> lock(calculationMutex); }
+    m_passCompleted.notify_all();
+    wake();
+}
+
+void Solver::setCheckpoint(const std::string& path,
+                           std::chrono::seconds interval) {
     std::lock_guard<std::mutex> lock(calculationMutex);
-    m_viewScale *= factor;
-    resetGrid();
-    printLocation();
+
+    m_checkpointPath = path;
+    m_checkpointInterval = interval;
+    m_lastCheckpoint = std::chrono::steady_clock::now();
+    wake();
 }
-void Solver::zoomOut(double factor) {
+
+void Solver::saveCheckpoint(const std::string& path) {
+    Checkpoint checkpoint;
+    {
+        std::lock_guard<std::mutex> lock(calculationMutex);
+        if (m_renderMode != RenderMode::escapeTime) {
+            throw std::runtime_error(
+                "density render modes aren't checkpointed");
+        }
+        if (m_distanceEstimation) {
+            throw std::runtime_error("distance estimation isn't checkpointed");
+        }
+        // A pass interrupted by a view change leaves the grid part reset.
+        if (!isCheckpointable()) {
+            throw std::runtime_error("no completed pass of the current view");
+        }
+        snapshot(checkpoint);
+    }
+    // Through the writer, which may still be writing a periodic checkpoint.
+    m_checkpointWriter.write(checkpoint, path);
+}
+
+void Solver::loadCheckpoint(const std::string& path) {
+    CheckpointFile file(path);
+    const Checkpoint::Header& header = file.header();
+
     std::lock_guard<std::mutex> lock(calculationMutex);
-    m_viewScale /= factor;
-    resetGrid();
+
+    // The checkpoint replaces whatever view was queued.
+    Command command;
+    while (commandQueue.pop(command)) {
+        m_appliedCommandCount++;
+    }
+
+    m_width = header.width;
+    m_height = header.height;
+    aspectRatio = static_cast<double>(m_width) / static_cast<double>(m_height);
+    m_viewCenter = {header.viewCenterReal, header.viewCenterImag};
+    m_viewScale = header.viewScale;
+    m_fractalConstant = {header.constantReal, header.constantImag};
+    m_formula = static_cast<Formula>(
+        std::clamp(header.formula, 0, formulaCount - 1));
+    m_currentFractal = header.mandelbrotMode;
+    m_renderMode = RenderMode::escapeTime;
+    m_densityShards.clear();
+    for (auto& grid : m_densityGrids) {
+        grid.resize(0, 0);
+    }
+    m_densityMaxima = {};
+    m_sampleCount = 0;
+    m_distanceEstimation = false;
+    m_distanceGrid.resize(0, 0);
+    m_liveDerivatives.clear();
+    m_isBoundaryRefined = false;
+    m_refinementSampleCount = 0;
+    m_iterationMaximum = header.iterationMaximum;
+    m_escapeRadius = header.escapeRadius;
+    m_symmetry = static_cast<Symmetry>(std::clamp(
+        header.symmetry, 0, static_cast<int>(Symmetry::rotational)));
+    m_mirrorColumn = header.mirrorColumn;
+    m_mirrorRow = header.mirrorRow;
+
+    auto smoothIterations = file.smoothIterations();
+    m_smoothIterationGrid.resize(m_width, m_height);
+    std::copy(smoothIterations.begin(), smoothIterations.end(),
+              m_smoothIterationGrid.data());
+
+    m_escapeHistogram.assign(file.escapeIterationCounter());
+    m_escapeHistogram.publish();
+
+    m_liveValues.assign(file.liveValues().begin(), file.liveValues().end());
+    m_liveIndices.assign(file.liveIndices().begin(), file.liveIndices().end());
+    m_liveIterations.assign(file.liveIterations().begin(),
+                            file.liveIterations().end());
+
+    m_escapeCount = header.escapeCount;
+    m_iterationCount = header.iterationCount;
+
+    // The checkpoint was taken after a completed pass, so its frame can be
+    // shown straight away.
+    workQueue.setTaskCount(0);
+    m_frameVersion++;
+    m_passCompleted.notify_all();
+    wake();
+
+    m_peakMemory = std::max(m_peakMemory, memoryUsage());
+
+    std::cout << "resumed from " << path << " after " << m_iterationCount
+              << " passes\n";
     printLocation();
 }
 
+void Solver::snapshot(Checkpoint& checkpoint) {
+    TRACE_SCOPE("checkpoint snapshot");
+    Checkpoint::Header& header = checkpoint.header;
+    header = {};
+    header.width = m_width;
+    header.height = m_height;
+    header.viewCenterReal = m_viewCenter.real;
+    header.viewCenterImag = m_viewCenter.imag;
+    header.viewScale = m_viewScale;
+    header.constantReal = m_fractalConstant.real;
+    header.constantImag = m_fractalConstant.imag;
+    header.formula = static_cast<int>(m_formula);
+    header.mandelbrotMode = m_currentFractal;
+    header.iterationMaximum = m_iterationMaximum;
+    header.symmetry = static_cast<int>(m_symmetry);
+    header.escapeRadius = m_escapeRadius;
+    header.mirrorColumn = m_mirrorColumn;
+    header.mirrorRow = m_mirrorRow;
+    header.iterationCount = m_iterationCount;
+    header.escapeCount = m_escapeCount;
+
+    // Assigning into the old buffers reuses their memory, so this is little
+    // more than a copy of the grid and the live pool.
+    auto grid = m_smoothIterationGrid.elements();
+    checkpoint.smoothIterations.assign(grid.begin(), grid.end());
+    checkpoint.escapeIterationCounter = m_escapeHistogram.counts();
+    checkpoint.liveValues = m_liveValues;
+    checkpoint.liveIndices = m_liveIndices;
+    checkpoint.liveIterations = m_liveIterations;
+}
+
+bool Solver::isCheckpointable() const {
+    return m_iterationCount > 0 and m_renderMode == RenderMode::escapeTime and
+           !m_distanceEstimation and !workQueue.isAborted() and
+           commandQueue.empty();
+}
+
+bool Solver::isCheckpointDue() const {
+    return !m_checkpointPath.empty() and isCheckpointable() and
+           m_frameVersion != m_checkpointFrameVersion;
+}
+
+void Solver::checkpointIfDue() {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(calculationMutex);
+
+        // Only snapshot completed passes which haven't been saved yet.
+        if (!isCheckpointDue() or
+            std::chrono::steady_clock::now() - m_lastCheckpoint <
+                m_checkpointInterval) {
+            return;
+        }
+        snapshot(m_checkpointSnapshot);
+        path = m_checkpointPath;
+        m_lastCheckpoint = std::chrono::steady_clock::now();
+        m_checkpointFrameVersion = m_frameVersion;
+    }
+
+    // If the previous checkpoint is still being written this one is dropped,
+    // and the next is taken after another interval.
+    m_checkpointWriter.submit(m_checkpointSnapshot, path);
+}
+
+int Solver::getMaxIterationCount() { return m_iterationMaximum; }
+
+void Solver::setMaxIterationCount(int iterationMaximum) {
+    submit({.type = Command::Type::setMaxIterationCount,
+            .x = iterationMaximum});
+}
+
+void Solver::getFrameData(FrameData& frameData) {
+    std::unique_lock<std::mutex> lock(calculationMutex, std::defer_lock);
+    {
+        TRACE_SCOPE("frame data wait");
+        lock.lock();
+        m_passCompleted.wait(lock, [this] {
+            return !isRunning or
+                   (m_iterationCount > 0 and !workQueue.isAborted());
+        });
+    }
+    TRACE_SCOPE("frame data copy");
+
+    frameData.iterationCount = m_iterationCount;
+    frameData.iterationMaximum = m_iterationMaximum;
+
+    frameData.escapeCount = m_escapeCount;
+
+    frameData.appliedCommandCount = m_appliedCommandCount;
+
+    frameData.view = {.width = m_width,
+                      .height = m_height,
+                      .center = m_viewCenter,
+                      .scale = m_viewScale,
+                      .formula = m_formula,
+                      .mandelbrotMode = m_currentFractal,
+                      .constant = m_fractalConstant};
+
+    frameData.smoothIterationGrid = m_smoothIterationGrid;
+    frameData.distanceGrid = m_distanceGrid;
+    frameData.refinementSampleCount = m_refinementSampleCount;
+
+    frameData.renderMode = m_renderMode;
+    frameData.sampleCount = m_sampleCount;
+    frameData.densityGrids = m_densityGrids;
+    frameData.densityMaxima = m_densityMaxima;
+
+    m_escapeHistogram.copyTo(frameData.escapeHistogram);
+}
+
+unsigned long Solver::getFrameVersion() const { return m_frameVersion; }
+
+unsigned long Solver::getSubmittedCommandCount() const {
+    return m_submittedCommandCount;
+}
+
+void Solver::zoomIn(double factor) {
+    submit({.type = Command::Type::zoom, .factor = factor});
+}
+void Solver::zoomOut(double factor) {
+    submit({.type = Command::Type::zoom, .factor = 1.0 / factor});
+}
+
 void Solver::zoomOnPixel(int x, int y, double factor) {
-    std::lock_guard<std::mutex> lock(calculationMutex);
-    m_viewCenter = mapToComplex(x, y);
-    m_viewScale *= factor;
-    resetGrid();
-    printLocation();
+    submit({.type = Command::Type::zoomOnPixel,
+            .factor = factor,
+            .x = x,
+            .y = y});
 }
 
 void Solver::move(double real, double imag) {
-    std::lock_guard<std::mutex> lock(calculationMutex);
-    m_viewCenter += Complex(real / m_viewScale, imag / m_viewScale);
-    resetGrid();
-    printLocation();
+    submit({.type = Command::Type::move, .real = real, .imag = imag});
 }
 
 void Solver::printLocation() {
@@ -172,6 +754,19 @@ void Solver::printLocation() {
               << m_viewScale << ")\n";
 }
 
+void Solver::setVerbose(bool verbose) {
+    std::lock_guard<std::mutex> lock(calculationMutex);
+
+    m_verbose = verbose;
+}
+
+void Solver::printMemoryUsage() {
+    std::cout << "peak solver memory: "
+              << static_cast<double>(m_peakMemory) /
+                     static_cast<double>(m_width * m_height)
+              << " bytes/pixel (" << m_peakMemory / (1024 * 1024) << " MiB)\n";
+}
+
 Complex Solver::mapToComplex(double x, double y) {
     x += 0.5;
     y += 0.5;
@@ -189,59 +784,822 @@ Complex Solver::mapToComplex(double x, double y) {
     return Complex(x, y);
 }
 
-void Solver::rowIterator() {
-    auto [y, width] = workQueue.getTask();
+// Same mapping as Solver::mapToComplex.
+Complex Solver::View::pixelToComplex(double x, double y) const {
+    double realRange = 4.0 / scale;
+    double imaginaryRange =
+        realRange * (static_cast<double>(height) / static_cast<double>(width));
+    double real = center.real - 2.0 / scale + (x + 0.5) * (realRange / width);
+    double imag = center.imag - imaginaryRange / 2.0 +
+                  (y + 0.5) * (imaginaryRange / height);
+
+    return Complex(real, 2.0 * center.imag - imag);
+}
+
+void Solver::detectSymmetry() {
+    m_symmetry = Symmetry::none;
+    if (!m_symmetryEnabled) {
+        return;
+    }
+
+    // Distance of the mirror axis from the view centre in pixels, doubled.
+    // Mirror images of pixels only land on other pixels when these are whole.
+    double pixelSize = 4.0 / (m_viewScale * m_width);
+    double rowOffset = 2.0 * m_viewCenter.imag / pixelSize;
+    double columnOffset = 2.0 * m_viewCenter.real / pixelSize;
+    auto isWhole = [](double offset, int size) {
+        return std::abs(offset) < 2.0 * size and
+               std::abs(offset - std::round(offset)) < 1e-6;
+    };
+
+    if (m_currentFractal) {
+        // The initial z has to be real for the set to be symmetric.
+        if (hasConjugateSymmetry(m_formula) and
+            m_fractalConstant.imag == 0.0 and isWhole(rowOffset, m_height)) {
+            m_symmetry = Symmetry::conjugate;
+        }
+    } else {
+        if (hasPointSymmetry(m_formula) and isWhole(rowOffset, m_height) and
+            isWhole(columnOffset, m_width)) {
+            m_symmetry = Symmetry::rotational;
+        }
+    }
+
+    m_mirrorRow = m_height - 1 + std::lround(rowOffset);
+    m_mirrorColumn = m_width - 1 - std::lround(columnOffset);
+}
+
+bool Solver::mirrorOf(unsigned int index, unsigned int& mirrorIndex) const {
+    if (m_symmetry == Symmetry::none) {
+        return false;
+    }
+
+    long x = index % m_width;
+    long y = index / m_width;
+
+    long mirrorX = m_symmetry == Symmetry::rotational ? m_mirrorColumn - x : x;
+    long mirrorY = m_mirrorRow - y;
+    if (mirrorX < 0 or mirrorX >= m_width or mirrorY < 0 or
+        mirrorY >= m_height) {
+        return false;
+    }
 
-    while (y != -1) {
-        for (int x = 0; x < m_width; x++) {
+    mirrorIndex = mirrorY * m_width + mirrorX;
+    return mirrorIndex != index;
+}
+
+template <typename FormulaType, bool mandelbrotMode, bool distanceEstimation>
+void Solver::chunkIterator() {
+    auto [task, length] = workQueue.getTask();
+
+    const double escapeRadiusSquared = m_escapeRadius * m_escapeRadius;
+    const unsigned int iterationMaximum = m_iterationMaximum;
+    const double logDegree = std::log2(FormulaType::degree);
+    const double pixelSize = 4.0 / (m_viewScale * m_width);
+
+    while (task != -1) {
+        TRACE_SCOPE("iterate chunk");
+        std::size_t chunk = m_chunkOrder[task];
+        std::size_t begin = chunk * length;
+        std::size_t end = std::min(begin + length, m_liveValues.size());
+
+        // Out of time, leave the chunk as it is for the next pass.
+        // The most important chunk is always iterated.
+        if (task > 0 and m_passHasDeadline and
+            std::chrono::steady_clock::now() > m_passDeadline) {
+            m_chunkLiveCounts[chunk] = end - begin;
+            m_chunkEscapeCounts[chunk] = 0;
+            m_chunkEscapeIterations[chunk].clear();
+            std::tie(task, length) = workQueue.getTask();
+            continue;
+        }
+
+        const unsigned int chunkIterations = m_chunkIterations[chunk];
+        std::size_t kept = begin;
+        int escapes = 0;
+        // A chunk's pixels escape at a few iterations per pass at most, the
+        // latest is searched first.
+        auto& escapeIterations = m_chunkEscapeIterations[chunk];
+        escapeIterations.clear();
+        auto countEscapes = [&escapeIterations](unsigned int iteration,
+                                                int count) {
+            for (auto entry = escapeIterations.rbegin();
+                 entry != escapeIterations.rend(); entry++) {
+                if (entry->first == iteration) {
+                    entry->second += count;
+                    return;
+                }
+            }
+            escapeIterations.emplace_back(iteration, count);
+        };
+        unsigned int mirrorIndex;
+
+        for (std::size_t i = begin; i < end; i++) {
             if (workQueue.isAborted()) [[unlikely]] {
                 break;
             }
-            if (m_magnitudeSquaredGrid[x, y] <=
-                m_escapeRadius * m_escapeRadius) {
-                if (m_currentFractal) { // mandelbrot set.
-                    m_grid[x, y].squareAdd(mapToComplex(x, y));
-                } else { // julia set.
-                    m_grid[x, y].squareAdd(m_fractalConstant);
+            Complex z = m_liveValues[i];
+            unsigned int index = m_liveIndices[i];
+            unsigned int iteration = m_liveIterations[i];
+
+            Complex c;
+            if constexpr (mandelbrotMode) {
+                c = mapToComplex(index % m_width, index / m_width);
+            } else {
+                c = m_fractalConstant;
+            }
+            Complex dz;
+            if constexpr (distanceEstimation) {
+                dz = m_liveDerivatives[i];
+            }
+
+            unsigned int lastIteration =
+                std::min(iteration + chunkIterations, iterationMaximum);
+            double magnitudeSquared = 0.0;
+            iteration =
+                iterateOrbit<FormulaType, mandelbrotMode, distanceEstimation>(
+                    z, dz, c, iteration, lastIteration, escapeRadiusSquared,
+                    magnitudeSquared);
+
+            if (magnitudeSquared > escapeRadiusSquared) {
+                m_smoothIterationGrid[index] =
+                    std::max(0.0, iteration -
+                                      std::log2(std::log2(magnitudeSquared)) /
+                                          logDegree);
+                if constexpr (distanceEstimation) {
+                    m_distanceGrid[index] =
+                        exteriorDistance(magnitudeSquared, dz) / pixelSize;
+                }
+                int pixelEscapes = 1;
+                if (mirrorOf(index, mirrorIndex)) {
+                    m_smoothIterationGrid[mirrorIndex] =
+                        m_smoothIterationGrid[index];
+                    if constexpr (distanceEstimation) {
+                        m_distanceGrid[mirrorIndex] = m_distanceGrid[index];
+                    }
+                    pixelEscapes++;
                 }
-                m_magnitudeSquaredGrid[x, y] = m_grid[x, y].magnitudeSquared();
-                m_iterationGrid[x, y]++;
+                escapes += pixelEscapes;
+                countEscapes(iteration, pixelEscapes);
+            } else if (iteration < iterationMaximum) {
+                m_liveValues[kept] = z;
+                m_liveIndices[kept] = index;
+                m_liveIterations[kept] = iteration;
+                if constexpr (distanceEstimation) {
+                    m_liveDerivatives[kept] = dz;
+                }
+                kept++;
+            }
+            // Otherwise the pixel reached the maximum iteration count without
+            // escaping, it is left out of the pool as part of the set.
+        }
+        m_chunkLiveCounts[chunk] = kept - begin;
+        m_chunkEscapeCounts[chunk] = escapes;
 
-                if (m_magnitudeSquaredGrid[x, y] >
-                    m_escapeRadius * m_escapeRadius) {
-                    m_escapeCount++;
-                    escapeIterationCounter[m_iterationGrid[x, y] - 1]++;
+        std::tie(task, length) = workQueue.getTask();
+    }
+}
+
+template <typename FormulaType>
+Solver::Worker Solver::selectChunkIteratorMode() const {
+    if (m_currentFractal) {
+        if (m_distanceEstimation) {
+            return &Solver::chunkIterator<FormulaType, true, true>;
+        }
+        return &Solver::chunkIterator<FormulaType, true, false>;
+    }
+    if (m_distanceEstimation) {
+        return &Solver::chunkIterator<FormulaType, false, true>;
+    }
+    return &Solver::chunkIterator<FormulaType, false, false>;
+}
+
+Solver::Worker Solver::selectChunkIterator() const {
+    switch (m_formula) {
+    case Formula::burningShip:
+        return selectChunkIteratorMode<BurningShipFormula>();
+    case Formula::tricorn:
+        return selectChunkIteratorMode<TricornFormula>();
+    case Formula::multibrot3:
+        return selectChunkIteratorMode<MultibrotFormula<3>>();
+    case Formula::multibrot4:
+        return selectChunkIteratorMode<MultibrotFormula<4>>();
+    case Formula::mandelbrot:
+    default:
+        return selectChunkIteratorMode<MandelbrotFormula>();
+    }
+}
+
+template <typename FormulaType, bool mandelbrotMode, bool antiBuddhabrot>
+void Solver::densitySampler() {
+    std::array<Grid2d<std::uint32_t>, 3>& shard =
+        m_densityShards[m_nextDensityShard++];
+
+    // Orbits outside radius 2 leave the plane of the sampled points for good.
+    const double escapeRadiusSquared = 4.0;
+    const unsigned int iterationMaximum = m_iterationMaximum;
+    const std::array<unsigned int, 3> channelIterations = {
+        iterationMaximum, std::max(iterationMaximum / 10, 1u),
+        std::max(iterationMaximum / 100, 1u)};
+
+    // Inverse of mapToComplex.
+    const double pixelsPerUnit = m_width * m_viewScale / 4.0;
+    const double left = m_viewCenter.real - 2.0 / m_viewScale;
+    const double top = m_viewCenter.imag + m_height / (2.0 * pixelsPerUnit);
+
+    std::vector<Complex> orbit(iterationMaximum);
+
+    auto [task, length] = workQueue.getTask();
+    while (task != -1) {
+        TRACE_SCOPE("sample orbits");
+        // Seeded by pass and task rather than by worker, so the image doesn't
+        // depend on which worker takes which task.
+        std::mt19937_64 random((static_cast<std::uint64_t>(m_iterationCount)
+                                << 32) |
+                               static_cast<std::uint64_t>(task));
+        std::uniform_real_distribution<double> coordinate(-2.0, 2.0);
+
+        for (unsigned int sample = 0; sample < length; sample++) {
+            if (workQueue.isAborted()) [[unlikely]] {
+                break;
+            }
+            Complex point(coordinate(random), coordinate(random));
+
+            Complex z, c;
+            if constexpr (mandelbrotMode) {
+                // The main cardioid and the period two bulb never escape.
+                if constexpr (!antiBuddhabrot and
+                              std::is_same_v<FormulaType, MandelbrotFormula>) {
+                    double x = point.real - 0.25;
+                    double ySquared = point.imag * point.imag;
+                    double q = x * x + ySquared;
+                    if (q * (q + x) <= 0.25 * ySquared or
+                        (point.real + 1.0) * (point.real + 1.0) + ySquared <=
+                            0.0625) {
+                        continue;
+                    }
+                }
+                z = Complex(0.0, 0.0);
+                c = point;
+            } else {
+                z = point;
+                c = m_fractalConstant;
+            }
+
+            unsigned int iteration = 0;
+            bool escaped = false;
+            while (iteration < iterationMaximum) {
+                FormulaType::step(z, c);
+                orbit[iteration++] = z;
+                if (z.magnitudeSquared() > escapeRadiusSquared) {
+                    escaped = true;
+                    break;
+                }
+            }
+
+            for (int channel = 0; channel < 3; channel++) {
+                unsigned int limit = channelIterations[channel];
+                unsigned int plotted;
+                if constexpr (antiBuddhabrot) {
+                    if (escaped and iteration <= limit) {
+                        continue;
+                    }
+                    plotted = limit;
+                } else {
+                    if (!escaped or iteration > limit) {
+                        continue;
+                    }
+                    plotted = iteration;
+                }
+
+                // The first point of a mandelbrot orbit is the sample itself,
+                // which would only add uniform noise.
+                Grid2d<std::uint32_t>& grid = shard[channel];
+                for (unsigned int i = mandelbrotMode ? 1 : 0; i < plotted;
+                     i++) {
+                    double x = (orbit[i].real - left) * pixelsPerUnit;
+                    double y = (top - orbit[i].imag) * pixelsPerUnit;
+                    if (x >= 0.0 and x < m_width and y >= 0.0 and
+                        y < m_height) {
+                        grid[static_cast<std::size_t>(x),
+                             static_cast<std::size_t>(y)]++;
+                    }
                 }
             }
         }
 
-        std::tie(y, width) = workQueue.getTask();
+        std::tie(task, length) = workQueue.getTask();
+    }
+}
+
+template <typename FormulaType>
+Solver::Worker Solver::selectDensitySamplerMode() const {
+    bool antiBuddhabrot = m_renderMode == RenderMode::antiBuddhabrot;
+    if (m_currentFractal) {
+        if (antiBuddhabrot) {
+            return &Solver::densitySampler<FormulaType, true, true>;
+        }
+        return &Solver::densitySampler<FormulaType, true, false>;
+    }
+    if (antiBuddhabrot) {
+        return &Solver::densitySampler<FormulaType, false, true>;
+    }
+    return &Solver::densitySampler<FormulaType, false, false>;
+}
+
+Solver::Worker Solver::selectDensitySampler() const {
+    switch (m_formula) {
+    case Formula::burningShip:
+        return selectDensitySamplerMode<BurningShipFormula>();
+    case Formula::tricorn:
+        return selectDensitySamplerMode<TricornFormula>();
+    case Formula::multibrot3:
+        return selectDensitySamplerMode<MultibrotFormula<3>>();
+    case Formula::multibrot4:
+        return selectDensitySamplerMode<MultibrotFormula<4>>();
+    case Formula::mandelbrot:
+    default:
+        return selectDensitySamplerMode<MandelbrotFormula>();
     }
 }
 
+template <typename FormulaType, bool mandelbrotMode>
+void Solver::boundaryRefiner() {
+    auto [task, length] = workQueue.getTask();
+
+    const double escapeRadiusSquared = m_escapeRadius * m_escapeRadius;
+    const unsigned int iterationMaximum =
+        m_iterationMaximum * refinementIterationFactor;
+    const double logDegree = std::log2(FormulaType::degree);
+    const double pixelSize = 4.0 / (m_viewScale * m_width);
+
+    // Iterates the point at pixel (x, y) from the start. Returns the escape
+    // iteration, or 0 if it doesn't escape, and sets its smooth iteration
+    // count and distance estimate.
+    auto iteratePoint = [&](double x, double y, float& smoothIterationCount,
+                            float& distance) -> unsigned int {
+        Complex point = mapToComplex(x, y);
+        Complex z, c, dz;
+        if constexpr (mandelbrotMode) {
+            z = m_fractalConstant;
+            c = point;
+            dz = Complex(0.0, 0.0);
+        } else {
+            z = point;
+            c = m_fractalConstant;
+            dz = Complex(1.0, 0.0);
+        }
+
+        double magnitudeSquared = 0.0;
+        unsigned int iteration =
+            iterateOrbit<FormulaType, mandelbrotMode, true>(
+                z, dz, c, 0, iterationMaximum, escapeRadiusSquared,
+                magnitudeSquared);
+        if (magnitudeSquared <= escapeRadiusSquared) {
+            return 0;
+        }
+        smoothIterationCount = std::max(
+            0.0,
+            iteration - std::log2(std::log2(magnitudeSquared)) / logDegree);
+        distance = exteriorDistance(magnitudeSquared, dz) / pixelSize;
+        return iteration;
+    };
+
+    while (task != -1) {
+        TRACE_SCOPE("refine boundary");
+        std::size_t begin = static_cast<std::size_t>(task) * length;
+        std::size_t end = std::min(begin + length, m_refinementIndices.size());
+
+        unsigned long samples = 0;
+        int escapes = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            if (workQueue.isAborted()) [[unlikely]] {
+                break;
+            }
+            unsigned int index = m_refinementIndices[i];
+            double x = index % m_width;
+            double y = index / m_width;
+            unsigned int mirrorIndex = index;
+            bool hasMirror = mirrorOf(index, mirrorIndex);
+            float smoothIterationCount, distance;
+
+            if (m_smoothIterationGrid[index] >= 0.0f) {
+                // The colour changes within the pixel this close to the set,
+                // average the escaped samples of a 2x2 grid over the pixel.
+                float sum = 0.0f;
+                int escaped = 0;
+                for (int sample = 0; sample < 4; sample++) {
+                    if (iteratePoint(x + (sample % 2 ? 0.25 : -0.25),
+                                     y + (sample / 2 ? 0.25 : -0.25),
+                                     smoothIterationCount, distance) != 0) {
+                        sum += smoothIterationCount;
+                        escaped++;
+                    }
+                }
+                samples += 4;
+                if (escaped > 0) {
+                    m_smoothIterationGrid[index] = sum / escaped;
+                    if (hasMirror) {
+                        m_smoothIterationGrid[mirrorIndex] = sum / escaped;
+                    }
+                }
+                continue;
+            }
+
+            // Next to the boundary, the pixel may escape after the maximum
+            // iteration count.
+            unsigned int iteration =
+                iteratePoint(x, y, smoothIterationCount, distance);
+            samples++;
+            if (iteration == 0) {
+                continue;
+            }
+            m_smoothIterationGrid[index] = smoothIterationCount;
+            m_distanceGrid[index] = distance;
+            int pixelEscapes = 1;
+            if (hasMirror) {
+                m_smoothIterationGrid[mirrorIndex] = smoothIterationCount;
+                m_distanceGrid[mirrorIndex] = distance;
+                pixelEscapes++;
+            }
+            escapes += pixelEscapes;
+            // Late escapes share the last histogram bin.
+            m_escapeHistogram.add(
+                std::min<unsigned int>(iteration, m_iterationMaximum),
+                pixelEscapes);
+        }
+        m_refinementSampleCount += samples;
+        m_escapeCount += escapes;
+
+        std::tie(task, length) = workQueue.getTask();
+    }
+}
+
+template <typename FormulaType>
+Solver::Worker Solver::selectBoundaryRefinerMode() const {
+    if (m_currentFractal) {
+        return &Solver::boundaryRefiner<FormulaType, true>;
+    }
+    return &Solver::boundaryRefiner<FormulaType, false>;
+}
+
+Solver::Worker Solver::selectBoundaryRefiner() const {
+    switch (m_formula) {
+    case Formula::burningShip:
+        return selectBoundaryRefinerMode<BurningShipFormula>();
+    case Formula::tricorn:
+        return selectBoundaryRefinerMode<TricornFormula>();
+    case Formula::multibrot3:
+        return selectBoundaryRefinerMode<MultibrotFormula<3>>();
+    case Formula::multibrot4:
+        return selectBoundaryRefinerMode<MultibrotFormula<4>>();
+    case Formula::mandelbrot:
+    default:
+        return selectBoundaryRefinerMode<MandelbrotFormula>();
+    }
+}
+
+void Solver::compactLivePixels() {
+    TRACE_SCOPE("compact live pixels");
+    std::size_t liveCount = 0;
+    int escapes = 0;
+    for (std::size_t chunk = 0; chunk < m_chunkLiveCounts.size(); chunk++) {
+        escapes += m_chunkEscapeCounts[chunk];
+        for (auto [iteration, count] : m_chunkEscapeIterations[chunk]) {
+            m_escapeHistogram.add(iteration, count);
+        }
+
+        std::size_t begin = chunk * liveChunkLength;
+        std::size_t count = m_chunkLiveCounts[chunk];
+        if (begin != liveCount) {
+            std::move(m_liveValues.begin() + begin,
+                      m_liveValues.begin() + begin + count,
+                      m_liveValues.begin() + liveCount);
+            std::move(m_liveIndices.begin() + begin,
+                      m_liveIndices.begin() + begin + count,
+                      m_liveIndices.begin() + liveCount);
+            std::move(m_liveIterations.begin() + begin,
+                      m_liveIterations.begin() + begin + count,
+                      m_liveIterations.begin() + liveCount);
+            if (m_distanceEstimation) {
+                std::move(m_liveDerivatives.begin() + begin,
+                          m_liveDerivatives.begin() + begin + count,
+                          m_liveDerivatives.begin() + liveCount);
+            }
+        }
+        liveCount += count;
+    }
+
+    m_escapeCount += escapes;
+
+    m_liveValues.resize(liveCount);
+    m_liveIndices.resize(liveCount);
+    m_liveIterations.resize(liveCount);
+    m_liveDerivatives.resize(m_distanceEstimation ? liveCount : 0);
+    if (liveCount * 4 < m_liveValues.capacity()) {
+        m_liveValues.shrink_to_fit();
+        m_liveIndices.shrink_to_fit();
+        m_liveIterations.shrink_to_fit();
+        m_liveDerivatives.shrink_to_fit();
+    }
+}
+
+void Solver::scheduleChunks(std::size_t chunkCount) {
+    m_chunkOrder.resize(chunkCount);
+    std::iota(m_chunkOrder.begin(), m_chunkOrder.end(), 0);
+
+    if (m_scheduling == Scheduling::uniform) {
+        m_chunkIterations.assign(chunkCount, 1);
+        m_passHasDeadline = false;
+        return;
+    }
+
+    // Order chunks by the distance of their middle pixel from the focus.
+    float focusX = m_focusX;
+    float focusY = m_focusY;
+    if (focusX < 0.0f or focusY < 0.0f) {
+        focusX = 0.5f * m_width;
+        focusY = 0.5f * m_height;
+    }
+    std::vector<float> distances(chunkCount);
+    for (std::size_t chunk = 0; chunk < chunkCount; chunk++) {
+        std::size_t middle =
+            std::min(chunk * liveChunkLength + liveChunkLength / 2,
+                     m_liveIndices.size() - 1);
+        float x = m_liveIndices[middle] % m_width - focusX;
+        float y = m_liveIndices[middle] / m_width - focusY;
+        distances[chunk] = x * x + y * y;
+    }
+    std::sort(m_chunkOrder.begin(), m_chunkOrder.end(),
+              [&distances](std::size_t a, std::size_t b) {
+                  return distances[a] < distances[b];
+              });
+
+    // Closer chunks get more iterations: the closest sixteenth 16 per pass,
+    // the next sixteenth 8, then an eighth 4, a quarter 2 and the rest 1.
+    m_chunkIterations.resize(chunkCount);
+    for (std::size_t rank = 0; rank < chunkCount; rank++) {
+        std::size_t share = rank * 16 / chunkCount;
+        unsigned int iterations = share < 1   ? 16
+                                  : share < 2 ? 8
+                                  : share < 4 ? 4
+                                  : share < 8 ? 2
+                                              : 1;
+        m_chunkIterations[m_chunkOrder[rank]] = iterations;
+    }
+
+    m_passHasDeadline = true;
+    m_passDeadline = std::chrono::steady_clock::now() + foveatedPassBudget;
+}
+
+std::size_t Solver::memoryUsage() const {
+    return m_smoothIterationGrid.size() * sizeof(float) +
+           m_liveValues.capacity() * sizeof(Complex) +
+           m_liveIndices.capacity() * sizeof(unsigned int) +
+           m_liveIterations.capacity() * sizeof(unsigned int) +
+           m_liveDerivatives.capacity() * sizeof(Complex) +
+           m_distanceGrid.size() * sizeof(float) +
+           m_refinementIndices.capacity() * sizeof(unsigned int) +
+           m_escapeHistogram.memoryUsage() +
+           m_densityShards.size() * 3 * m_smoothIterationGrid.size() *
+               sizeof(std::uint32_t) +
+           3 * m_densityGrids[0].size() * sizeof(std::uint32_t);
+}
+
+void Solver::runWorkers(Worker worker) {
+    if (m_threadCount == 1 and m_workerCpus.empty()) {
+        (this->*worker)();
+        return;
+    }
+
+    std::vector<std::jthread> threads;
+
+    for (unsigned int i = 0u; i < m_threadCount; i++) {
+        if (m_workerCpus.empty()) {
+            threads.push_back(std::jthread(worker, this));
+        } else {
+            int cpu = m_workerCpus[i % m_workerCpus.size()];
+            threads.push_back(std::jthread([this, worker, cpu] {
+                pinCurrentThread(cpu);
+                (this->*worker)();
+            }));
+        }
+    }
+}
+
+bool Solver::isFinished() const {
+    if (m_renderMode == RenderMode::escapeTime) {
+        return m_liveValues.empty() and
+               (!m_distanceEstimation or m_isBoundaryRefined);
+    }
+    return m_sampleCount >= densitySamplesPerPixel * m_width * m_height;
+}
+
 void Solver::iterateGrid() {
-    if (m_iterationCount < m_iterationMaximum) {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1));
-        std::lock_guard<std::mutex> lock(calculationMutex);
+    if (m_renderMode != RenderMode::escapeTime) {
+        sampleDensity();
+        return;
+    }
+    if (m_liveValues.empty()) {
+        refineBoundary();
+        return;
+    }
 
-        workQueue.setTaskCount(m_height);
-        workQueue.setTaskLength(m_width);
+    std::unique_lock<std::mutex> lock(calculationMutex, std::defer_lock);
+    {
+        TRACE_SCOPE("pass lock wait");
+        lock.lock();
+    }
+    TRACE_SCOPE("pass");
 
-        {
-            unsigned int threadCount = std::thread::hardware_concurrency();
-            std::vector<std::jthread> threads;
+    // Queued commands will reset the grid, apply them first.
+    if (!commandQueue.empty()) {
+        return;
+    }
+
+    unsigned int taskCount =
+        (m_liveValues.size() + liveChunkLength - 1) / liveChunkLength;
+    m_chunkLiveCounts.assign(taskCount, 0);
+    m_chunkEscapeCounts.assign(taskCount, 0);
+    // Entries are cleared by the chunks, which keeps their capacity.
+    m_chunkEscapeIterations.resize(taskCount);
+    scheduleChunks(taskCount);
+
+    workQueue.setTaskCount(taskCount);
+    workQueue.setTaskLength(liveChunkLength);
+
+    runWorkers(selectChunkIterator());
+
+    if (!workQueue.isAborted()) [[likely]] {
+        compactLivePixels();
+        m_escapeHistogram.publish();
+
+        m_iterationCount++;
+        m_frameVersion++;
+        m_passCompleted.notify_all();
+
+        if (m_liveValues.empty() and m_verbose) {
+            std::cout << "max iteration count reached\n";
+            printMemoryUsage();
+        }
+    }
+}
+
+void Solver::sampleDensity() {
+    if (isFinished()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(calculationMutex, std::defer_lock);
+    {
+        TRACE_SCOPE("pass lock wait");
+        lock.lock();
+    }
+    TRACE_SCOPE("density pass");
+
+    // Queued commands will reset the grid, apply them first.
+    if (!commandQueue.empty()) {
+        return;
+    }
+
+    // The thread count may have changed since the reset.
+    while (m_densityShards.size() < m_threadCount) {
+        for (auto& grid : m_densityShards.emplace_back()) {
+            grid.resize(m_width, m_height);
+            grid.fill(0);
+        }
+    }
+    m_nextDensityShard = 0;
+
+    // Orbit lengths vary a lot, a few tasks per worker balance them. Up to 16
+    // workers the tasks, and so the image, don't depend on the worker count.
+    unsigned int taskCount = std::max(m_threadCount * 4, 64u);
+    workQueue.setTaskCount(taskCount);
+    workQueue.setTaskLength(densityTaskSamples);
+
+    runWorkers(selectDensitySampler());
+
+    if (!workQueue.isAborted()) [[likely]] {
+        foldDensityShards();
+        m_sampleCount += static_cast<unsigned long>(taskCount) *
+                         densityTaskSamples;
+        m_iterationCount++;
+        m_frameVersion++;
+        m_passCompleted.notify_all();
+
+        if (isFinished() and m_verbose) {
+            std::cout << "density sample count reached\n";
+            printMemoryUsage();
+        }
+    }
+}
 
-            for (unsigned int i = 0u; i < threadCount; i++) {
-                threads.push_back(std::jthread(&Solver::rowIterator, this));
+void Solver::densityFolder() {
+    auto [task, length] = workQueue.getTask();
+    while (task != -1) {
+        TRACE_SCOPE("fold density");
+        std::size_t begin = static_cast<std::size_t>(task) * length;
+        std::size_t end = std::min(begin + length, m_densityGrids[0].size());
+        for (int channel = 0; channel < 3; channel++) {
+            std::span<std::uint32_t> sums = m_densityGrids[channel].elements();
+            for (auto& shard : m_densityShards) {
+                std::span<std::uint32_t> counts = shard[channel].elements();
+                for (std::size_t i = begin; i < end; i++) {
+                    sums[i] += counts[i];
+                    counts[i] = 0;
+                }
             }
+            m_densityTaskMaxima[task][channel] =
+                *std::max_element(sums.begin() + begin, sums.begin() + end);
         }
+        std::tie(task, length) = workQueue.getTask();
+    }
+}
 
-        if (!workQueue.isAborted()) [[likely]] {
-            m_iterationCount++;
+void Solver::foldDensityShards() {
+    std::size_t size = m_densityGrids[0].size();
+    if (size == 0) {
+        return;
+    }
+    unsigned int taskCount = (size + densityFoldLength - 1) / densityFoldLength;
+    m_densityTaskMaxima.assign(taskCount, {});
+    workQueue.setTaskCount(taskCount);
+    workQueue.setTaskLength(densityFoldLength);
+    runWorkers(&Solver::densityFolder);
 
-            if (m_iterationCount >= m_iterationMaximum) {
-                std::cout << "max iteration count reached\n";
+    for (const auto& maxima : m_densityTaskMaxima) {
+        for (int channel = 0; channel < 3; channel++) {
+            m_densityMaxima[channel] =
+                std::max(m_densityMaxima[channel], maxima[channel]);
+        }
+    }
+}
+
+void Solver::refineBoundary() {
+    if (isFinished()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(calculationMutex, std::defer_lock);
+    {
+        TRACE_SCOPE("pass lock wait");
+        lock.lock();
+    }
+    TRACE_SCOPE("refinement pass");
+
+    // Queued commands will reset the grid, apply them first. Settings may
+    // have reset it since the check above.
+    if (!commandQueue.empty() or !m_liveValues.empty() or isFinished()) {
+        return;
+    }
+
+    // Escaped pixels closer than a pixel to the set, and pixels that haven't
+    // escaped next to one. Mirror images are refined along with their pixel.
+    m_refinementIndices.clear();
+    auto isNearBoundary = [this](long x, long y) {
+        if (x < 0 or x >= m_width or y < 0 or y >= m_height) {
+            return false;
+        }
+        std::size_t index = y * m_width + x;
+        return m_smoothIterationGrid[index] >= 0.0f and
+               m_distanceGrid[index] < 1.0f;
+    };
+    unsigned int mirrorIndex;
+    for (long y = 0; y < m_height; y++) {
+        for (long x = 0; x < m_width; x++) {
+            unsigned int index = y * m_width + x;
+            if (mirrorOf(index, mirrorIndex) and mirrorIndex < index) {
+                continue;
+            }
+            if (m_smoothIterationGrid[index] >= 0.0f
+                    ? m_distanceGrid[index] < 1.0f
+                    : isNearBoundary(x - 1, y) or isNearBoundary(x + 1, y) or
+                          isNearBoundary(x, y - 1) or
+                          isNearBoundary(x, y + 1)) {
+                m_refinementIndices.push_back(index);
             }
         }
     }
+
+    workQueue.setTaskCount(
+        (m_refinementIndices.size() + refinementTaskLength - 1) /
+        refinementTaskLength);
+    workQueue.setTaskLength(refinementTaskLength);
+
+    runWorkers(selectBoundaryRefiner());
+
+    if (!workQueue.isAborted()) [[likely]] {
+        m_escapeHistogram.publish();
+        m_isBoundaryRefined = true;
+        m_iterationCount++;
+        m_frameVersion++;
+        m_passCompleted.notify_all();
+
+        if (m_verbose) {
+            std::cout << "refined " << m_refinementIndices.size()
+                      << " boundary pixels with " << m_refinementSampleCount
+                      << " samples\n";
+        }
+    }
+    m_peakMemory = std::max(m_peakMemory, memoryUsage());
 }
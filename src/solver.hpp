@@ -1,14 +1,33 @@
 #ifndef _MANDELBROTSOLVER
 #define _MANDELBROTSOLVER
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "checkpoint.hpp"
 #include "complex.hpp"
+#include "escapehistogram.hpp"
+#include "formula.hpp"
 #include "grid2d.hpp"
+#include "spscqueue.hpp"
+#include "threadconfig.hpp"
 #include "workqueue.hpp"
 
 // Wrapper for data and number crunching for the fractal solver.
+// Navigation functions don't block, they queue a command which the solver
+// applies between passes. All commands queued during one pass are applied
+// together, with a single grid reset.
+// Navigation functions must only be called from one thread at a time.
+// Once finished, calculationLoop sleeps until a command or setting changes the
+// view, so a converged solver doesn't use any CPU.
 class Solver {
 public:
     Solver();
@@ -18,19 +37,150 @@ public:
 
     void resizeGrid(int width, int height);
 
-    void resetGrid();
-
     void toggleJulia();
+    // Switches to the mandelbrot set, or to the julia set of a constant,
+    // without moving the view.
+    void setFractal(bool mandelbrotMode, double constantReal,
+                    double constantImag);
+
+    void setFormula(Formula formula);
+    // Switch to the next iteration formula.
+    void nextFormula();
+
+    // Escape time colours pixels by how many iterations they take to escape.
+    // The density modes instead plot the orbits of randomly sampled points:
+    // the buddhabrot those that escape, the anti-buddhabrot those that don't.
+    // Their red, green and blue channels plot orbits up to all, a tenth and a
+    // hundredth of the maximum iteration count.
+    enum class RenderMode {
+        escapeTime,
+        buddhabrot,
+        antiBuddhabrot,
+    };
+    static constexpr int renderModeCount = 3;
+    void setRenderMode(RenderMode renderMode);
+    // Switch to the next render mode.
+    void nextRenderMode();
 
     void calculationLoop();
 
+    // Called on calculationLoop's thread whenever the frame version changes,
+    // so readers can wait for new frames instead of polling. Must be set
+    // before calculationLoop starts.
+    void setFrameCallback(std::function<void()> onFrame);
+
+    // Applies queued commands, then iterates until every pixel has escaped or
+    // the maximum iteration count is reached, for headless rendering.
+    void solve();
+    // Like solve(), but returns early once budget has passed. Returns whether
+    // the solver finished, call again to continue.
+    bool solveFor(std::chrono::nanoseconds budget);
+
     void stop();
 
+    // The getters below return the applied settings, and are only safe to
+    // call from the thread that solves, or once it has stopped. The setters
+    // are queued like navigation and applied with it in a single reset.
     int getMaxIterationCount();
+    void setMaxIterationCount(int iterationMaximum);
+
+    // Mirrored pixels are only computed once where the view overlaps its own
+    // mirror image. Enabled by default.
+    void setSymmetryEnabled(bool enabled);
+
+    // Distance estimation carries the derivative of z through the iterations
+    // to estimate how far each escaped pixel lies from the set. Once the live
+    // pool empties, escaped pixels closer than a pixel to the set are
+    // supersampled, and pixels which haven't escaped next to them get more
+    // iterations. Disabled by default, and not checkpointed.
+    void setDistanceEstimation(bool enabled);
+    void toggleDistanceEstimation();
+    bool getDistanceEstimation() const;
+
+    // Uniform scheduling iterates every live pixel once per pass.
+    // Foveated scheduling gives chunks of pixels closer to the focus more
+    // iterations per pass, and leaves the furthest ones for later passes once
+    // a pass runs over its time budget.
+    enum class Scheduling {
+        uniform,
+        foveated,
+    };
+    void setScheduling(Scheduling scheduling);
+    Scheduling getScheduling() const;
+
+    // Focus of foveated scheduling in pixels. Negative coordinates focus on
+    // the centre of the screen, which is the default.
+    void setFocus(float x, float y);
+
+    // Writes a checkpoint to path from calculationLoop every interval, on a
+    // background thread. An empty path disables checkpoints.
+    void setCheckpoint(const std::string& path,
+                       std::chrono::seconds interval);
+    // Writes a checkpoint of the last completed pass to path now. Throws
+    // std::runtime_error if it can't be written, in a density mode, or if the
+    // grid doesn't hold a completed pass of the current view, in which case
+    // the file at path is left as it was.
+    void saveCheckpoint(const std::string& path);
+    // Restores the state saved in a checkpoint, dropping queued commands.
+    // Throws std::runtime_error if the file can't be read.
+    void loadCheckpoint(const std::string& path);
+
+    // Defaults to ThreadConfig::current() when the solver is constructed.
+    void setThreadConfig(const ThreadConfig& config);
 
-    void getFrameData(int& iterationCount, int& escapeCount,
-                      Grid2d<double>& magnitudeGrid, Grid2d<int>& iterationGrid,
-                      std::vector<int>& escapeIterationCounterSums);
+    // Where a frame lies in the complex plane.
+    struct View {
+        int width = 0, height = 0;
+        Complex center;
+        double scale = 1.0;
+        Formula formula = Formula::mandelbrot;
+        bool mandelbrotMode = true;
+        // Initial value of z in mandelbrot mode, c in julia mode.
+        Complex constant;
+
+        // Point at pixel (x, y), which may be fractional.
+        Complex pixelToComplex(double x, double y) const;
+    };
+
+    // Snapshot of the solver's results for drawing.
+    struct FrameData {
+        int iterationCount = 0;
+        int iterationMaximum = 0;
+        int escapeCount = 0;
+        // Number of navigation commands the frame reflects.
+        unsigned long appliedCommandCount = 0;
+        View view;
+        RenderMode renderMode = RenderMode::escapeTime;
+        // Orbits plotted on each pixel in the density modes, per colour
+        // channel, and the largest count of each channel. Empty in escape time
+        // mode.
+        std::array<Grid2d<std::uint32_t>, 3> densityGrids;
+        std::array<std::uint32_t, 3> densityMaxima = {};
+        unsigned long sampleCount = 0;
+        // Continuous escape iteration count of escaped pixels, or a negative
+        // value for pixels which haven't escaped.
+        Grid2d<float> smoothIterationGrid;
+        // Distribution of escape iterations for histogram colouring, only
+        // copied when it changed since the frame data was last filled.
+        EscapeHistogram::Table escapeHistogram;
+        // Estimated distance from escaped pixels to the set in pixels, or a
+        // negative value for other pixels. Empty unless distance estimation
+        // is enabled.
+        Grid2d<float> distanceGrid;
+        // Points iterated by boundary refinement.
+        unsigned long refinementSampleCount = 0;
+    };
+
+    // Sleeps until a pass has completed since the last view change while the
+    // solver is running, then copies its results.
+    void getFrameData(FrameData& frameData);
+
+    // Changes whenever the results change, so readers can skip unchanged
+    // frames. Zero until the solver first applies a view.
+    unsigned long getFrameVersion() const;
+
+    // Number of navigation commands submitted so far.
+    unsigned long getSubmittedCommandCount() const;
 
     void zoomIn(double factor);
     void zoomOut(double factor);
@@ -41,16 +191,113 @@ public:
 
     void printLocation();
 
+    void printMemoryUsage();
+
+    // Whether the solver prints its location and progress, on by default.
+    void setVerbose(bool verbose);
+
+    // Value of a pixel in the smooth iteration grid that hasn't escaped.
+    static constexpr float liveValue = -1.0f;
+
 private:
-    Grid2d<Complex> m_grid;
-    Grid2d<int> m_iterationGrid;
+    // Escaped pixels only keep their smooth iteration count.
+    Grid2d<float> m_smoothIterationGrid;
+
+    // Pixels that haven't escaped yet are kept in a dense pool, compacted after
+    // every pass, along with how many times each has been iterated. Pixels
+    // that reach the maximum iteration count leave the pool.
+    std::vector<Complex> m_liveValues;
+    std::vector<unsigned int> m_liveIndices;
+    std::vector<unsigned int> m_liveIterations;
+    std::vector<std::size_t> m_chunkLiveCounts;
+    std::vector<int> m_chunkEscapeCounts;
+    // Escapes of each chunk as (iteration, count), added to the escape
+    // histogram when the pass completes, so workers don't contend on its bins.
+    std::vector<std::vector<std::pair<unsigned int, int>>>
+        m_chunkEscapeIterations;
+    static constexpr unsigned int liveChunkLength = 4096;
+
+    // Order in which chunks are handed to workers this pass, iterations per
+    // chunk and the time after which remaining chunks are skipped.
+    std::atomic<Scheduling> m_scheduling;
+    std::atomic<float> m_focusX, m_focusY;
+    std::vector<std::size_t> m_chunkOrder;
+    std::vector<unsigned int> m_chunkIterations;
+    bool m_passHasDeadline;
+    std::chrono::steady_clock::time_point m_passDeadline;
+    static constexpr std::chrono::milliseconds foveatedPassBudget{16};
+
+    void scheduleChunks(std::size_t chunkCount);
 
-    Grid2d<double> m_magnitudeSquaredGrid;
+    // Distance estimation. Derivatives of live pixels are kept alongside the
+    // live pool. Refinement runs once after the pool empties, over the pixels
+    // collected in m_refinementIndices, with refinementIterationFactor times
+    // the maximum iteration count.
+    bool m_distanceEstimation;
+    Grid2d<float> m_distanceGrid;
+    std::vector<Complex> m_liveDerivatives;
+    bool m_isBoundaryRefined;
+    std::vector<unsigned int> m_refinementIndices;
+    std::atomic_ulong m_refinementSampleCount;
+    static constexpr unsigned int refinementTaskLength = 256;
+    static constexpr unsigned int refinementIterationFactor = 4;
 
-    std::vector<int> escapeIterationCounter;
+    // Refines pixels near the boundary, intended for use in multithreading.
+    // Compiled for every formula and for both mandelbrot and julia mode.
+    template <typename FormulaType, bool mandelbrotMode>
+    void boundaryRefiner();
+
+    // Density modes. Each worker plots into its own shard of the density
+    // grids, so plotting needs no atomics, and the shards are added to the
+    // density grids and cleared at the end of each pass. Samples are drawn in
+    // tasks seeded by pass and task, and stop at densitySamplesPerPixel
+    // samples per pixel.
+    RenderMode m_renderMode;
+    std::vector<std::array<Grid2d<std::uint32_t>, 3>> m_densityShards;
+    std::atomic_uint m_nextDensityShard;
+    std::array<Grid2d<std::uint32_t>, 3> m_densityGrids;
+    std::array<std::uint32_t, 3> m_densityMaxima;
+    // Maxima of each fold task, reduced once the fold is done.
+    std::vector<std::array<std::uint32_t, 3>> m_densityTaskMaxima;
+    static constexpr unsigned int densityFoldLength = 1 << 14;
+    unsigned long m_sampleCount;
+    static constexpr unsigned int densityTaskSamples = 4096;
+    static constexpr unsigned long densitySamplesPerPixel = 256;
+
+    // Draws samples for the density modes, intended for use in
+    // multithreading. Compiled for every formula, for both mandelbrot and
+    // julia mode, and for both density modes.
+    template <typename FormulaType, bool mandelbrotMode, bool antiBuddhabrot>
+    void densitySampler();
+    // Adds the shards to the density grids and clears them, intended for use
+    // in multithreading.
+    void densityFolder();
+    void foldDensityShards();
+
+    // Whether every pixel has escaped or reached the maximum iteration count
+    // and the boundary is refined, or enough orbits have been sampled.
+    bool isFinished() const;
+
+    // Symmetry of the current view. Pixels whose mirror image lies on the grid
+    // are computed once, and escapes are written to both pixels. Only used when
+    // the mirror axis falls exactly on the pixel grid.
+    enum class Symmetry {
+        none,
+        conjugate,  // (x, y) -> (x, mirrorRow - y)
+        rotational, // (x, y) -> (mirrorColumn - x, mirrorRow - y)
+    };
+    bool m_symmetryEnabled;
+    Symmetry m_symmetry;
+    long m_mirrorColumn, m_mirrorRow;
+
+    std::size_t m_peakMemory;
+
+    // Published after every pass.
+    EscapeHistogram m_escapeHistogram;
 
     std::atomic_int m_escapeCount;
     std::atomic_int m_iterationCount;
+    std::atomic_ulong m_frameVersion;
     int m_iterationMaximum;
     double m_escapeRadius;
     int m_width, m_height;
@@ -61,17 +308,143 @@ private:
     // true is mandelbrot, false is julia.
     bool m_currentFractal;
     Complex m_fractalConstant;
+    Formula m_formula;
+
+    struct Command {
+        enum class Type {
+            setView,
+            resize,
+            zoom,
+            zoomOnPixel,
+            move,
+            toggleJulia,
+            setFractal,
+            setFormula,
+            nextFormula,
+            setRenderMode,
+            nextRenderMode,
+            setMaxIterationCount,
+            setSymmetryEnabled,
+            setDistanceEstimation,
+            toggleDistanceEstimation,
+        };
+        Type type;
+        double real = 0.0, imag = 0.0, factor = 1.0;
+        int x = 0, y = 0;
+        Formula formula = Formula::mandelbrot;
+        RenderMode renderMode = RenderMode::escapeTime;
+    };
+    SpscQueue<Command, 256> commandQueue;
+    std::atomic_ulong m_submittedCommandCount;
+    unsigned long m_appliedCommandCount;
+
+    void submit(const Command& command);
+
+    // Applies every queued command, then resets the grid once.
+    void processCommands();
+
+    // Changes the view without resetting the grid.
+    void applyCommand(const Command& command);
+
+    std::atomic_bool isRunning;
+    std::function<void()> m_onFrame;
+
+    // Wakes calculationLoop when it is waiting for work.
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCondition;
+    bool m_isWakeRequested;
+    void wake();
+    // Sleeps until woken, or until an unsaved checkpoint is due.
+    void waitForWork();
 
-    bool isRunning;
+    // Notified with calculationMutex locked whenever a pass completes.
+    std::condition_variable m_passCompleted;
+
+    bool m_verbose;
+    unsigned int m_threadCount;
+    std::vector<int> m_workerCpus;
     WorkQueue workQueue;
     std::mutex calculationMutex;
 
     Complex mapToComplex(double x, double y);
 
-    // Iterates over one row of the grid, intended for use in multithreading.
-    void rowIterator();
+    // Refills the grid and the live pool or density shards for the current
+    // view. Must be called with calculationMutex locked.
+    void resetGrid();
+    void resetLivePool();
+
+    // Offsets of each tile's pixels in the live pool, computed in parallel
+    // during resetGrid. Tiles are square and numbered row by row.
+    static constexpr int tileSize = 64;
+    int m_tileColumns;
+    std::vector<std::size_t> m_tileLiveOffsets;
+    // Workers for the two halves of resetGrid, over tiles of the grid.
+    void countLiveTiles();
+    void fillLiveTiles();
+
+    void detectSymmetry();
+    // Returns whether the mirror image of the pixel at index is a different
+    // pixel on the grid, and if so sets mirrorIndex.
+    bool mirrorOf(unsigned int index, unsigned int& mirrorIndex) const;
+
+    // Iterates over chunks of the live pixel pool, intended for use in
+    // multithreading. Escaped pixels are dropped from their chunk.
+    // Compiled for every formula, for both mandelbrot and julia mode, and with
+    // and without distance estimation.
+    template <typename FormulaType, bool mandelbrotMode,
+              bool distanceEstimation>
+    void chunkIterator();
+
+    using Worker = void (Solver::*)();
+    // Runs worker on the configured number of threads, pinned if configured,
+    // and waits for them to finish. A single unpinned worker runs on the
+    // calling thread.
+    void runWorkers(Worker worker);
+
+    // Picks the chunk iterator for the current formula and mode, done once per
+    // pass.
+    Worker selectChunkIterator() const;
+    template <typename FormulaType> Worker selectChunkIteratorMode() const;
+    // Picks the density sampler for the current formula and modes.
+    Worker selectDensitySampler() const;
+    template <typename FormulaType> Worker selectDensitySamplerMode() const;
+    // Picks the boundary refiner for the current formula and mode.
+    Worker selectBoundaryRefiner() const;
+    template <typename FormulaType> Worker selectBoundaryRefinerMode() const;
+
+    // Joins the chunks left by chunkIterator into a dense pool again.
+    void compactLivePixels();
+
+    std::size_t memoryUsage() const;
+
+    // Periodic checkpoints. The state is copied into m_checkpointSnapshot
+    // under calculationMutex, which is then swapped to the writer thread.
+    std::string m_checkpointPath;
+    std::chrono::seconds m_checkpointInterval;
+    std::chrono::steady_clock::time_point m_lastCheckpoint;
+    unsigned long m_checkpointFrameVersion;
+    Checkpoint m_checkpointSnapshot;
+    CheckpointWriter m_checkpointWriter;
+
+    // Copies the state of the last completed pass into checkpoint.
+    // Must be called with calculationMutex locked.
+    void snapshot(Checkpoint& checkpoint);
+    // Whether the grid holds a completed pass of the current view that can be
+    // snapshot. Must be called with calculationMutex locked.
+    bool isCheckpointable() const;
+    // Whether checkpoints are enabled and the completed pass hasn't been
+    // saved yet, regardless of the interval. Must be called with
+    // calculationMutex locked.
+    bool isCheckpointDue() const;
+    void checkpointIfDue();
 
     void iterateGrid();
+    // A pass of the density modes, which samples orbits instead of iterating
+    // the live pool.
+    void sampleDensity();
+    // Refines the boundary once the live pool is empty, with distance
+    // estimation enabled.
+    void refineBoundary();
 };
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef _MANDELBROTSPSCQUEUE
+#define _MANDELBROTSPSCQUEUE
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded queue without locks for one producer thread and one consumer thread.
+// Holds up to capacity - 1 values.
+template <typename T, std::size_t capacity> class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Returns false if the queue is full.
+    bool push(const T& value) {
+        std::size_t currentTail = tail.load(std::memory_order_relaxed);
+        std::size_t nextTail = (currentTail + 1) % capacity;
+        if (nextTail == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        buffer[currentTail] = value;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty.
+    bool pop(T& value) {
+        std::size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = buffer[currentHead];
+        head.store((currentHead + 1) % capacity, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) ==
+               tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, capacity> buffer;
+
+    // Kept on separate cache lines so producer and consumer don't contend.
+    alignas(64) std::atomic_size_t head;
+    alignas(64) std::atomic_size_t tail;
+};
+
+#endif
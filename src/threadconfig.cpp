@@ -0,0 +1,247 @@
+#include "threadconfig.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Highest cpu number a cpu list may name, plus one.
+#ifdef __linux__
+constexpr int cpuLimit = CPU_SETSIZE;
+#else
+constexpr int cpuLimit = 1024;
+#endif
+
+int parseInt(std::string_view text, std::string_view what) {
+    std::size_t length;
+    int value;
+    try {
+        value = std::stoi(std::string(text), &length);
+    } catch (const std::exception&) {
+        length = 0;
+    }
+    if (length == 0 or length != text.size() or value < 0) {
+        throw std::invalid_argument("invalid " + std::string(what) + " '" +
+                                    std::string(text) + "'");
+    }
+    return value;
+}
+
+// CPUs the process is allowed to run on.
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+// Identifies the physical core of a CPU as (package, core), core is -1 if the
+// topology is unknown.
+std::pair<int, int> physicalCore(int cpu) {
+    std::string topology =
+        "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    int package = -1;
+    int core = -1;
+    std::ifstream(topology + "physical_package_id") >> package;
+    std::ifstream(topology + "core_id") >> core;
+    return {package, core};
+}
+
+} // namespace
+
+ThreadConfig::ThreadConfig() {
+    m_threadCount = 0;
+    m_smtPolicy = SmtPolicy::all;
+}
+
+ThreadConfig ThreadConfig::fromEnvironment() {
+    ThreadConfig config;
+
+    if (const char* threads = std::getenv("MANDELBROT_THREADS")) {
+        config.setThreadCount(parseInt(threads, "MANDELBROT_THREADS"));
+    }
+    if (const char* cpus = std::getenv("MANDELBROT_CPUS")) {
+        config.setCpus(cpus);
+    }
+    if (const char* smt = std::getenv("MANDELBROT_SMT")) {
+        config.setSmtPolicy(smt);
+    }
+
+    return config;
+}
+
+bool ThreadConfig::parseOption(const std::vector<std::string_view>& arguments,
+                               std::size_t& index) {
+    std::string_view option = arguments[index];
+    if (option != "--threads" and option != "--cpus" and option != "--smt") {
+        return false;
+    }
+    if (index + 1 >= arguments.size()) {
+        throw std::invalid_argument(std::string(option) + " needs a value");
+    }
+    std::string_view value = arguments[index + 1];
+
+    if (option == "--threads") {
+        setThreadCount(parseInt(value, "thread count"));
+    } else if (option == "--cpus") {
+        setCpus(value);
+    } else {
+        setSmtPolicy(value);
+    }
+
+    index += 2;
+    return true;
+}
+
+unsigned int ThreadConfig::threadCount() const {
+    if (m_threadCount > 0) {
+        return m_threadCount;
+    }
+
+    std::size_t cpuCount = workerCpus().size();
+    if (cpuCount > 0) {
+        return cpuCount;
+    }
+
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ThreadConfig::setThreadCount(unsigned int count) { m_threadCount = count; }
+
+std::vector<int> ThreadConfig::workerCpus() const {
+    if (m_cpus.empty() and m_smtPolicy == SmtPolicy::all) {
+        return {};
+    }
+
+    std::vector<int> cpus = m_cpus.empty() ? allowedCpus() : m_cpus;
+
+    if (m_smtPolicy == SmtPolicy::off) {
+        // Keep the first CPU of every physical core.
+        std::set<std::pair<int, int>> cores;
+        std::erase_if(cpus, [&cores](int cpu) {
+            auto core = physicalCore(cpu);
+            return core.second != -1 and !cores.insert(core).second;
+        });
+    }
+
+    return cpus;
+}
+
+std::string ThreadConfig::describe() const {
+    std::string description = std::to_string(threadCount()) + " threads";
+
+    std::vector<int> cpus = workerCpus();
+    if (cpus.empty()) {
+        return description + ", unpinned";
+    }
+
+    description += ", pinned to cpus";
+    for (std::size_t i = 0; i < cpus.size(); i++) {
+        description += i == 0 ? " " : ",";
+        description += std::to_string(cpus[i]);
+    }
+    return description;
+}
+
+const ThreadConfig& ThreadConfig::current() { return currentConfig(); }
+
+void ThreadConfig::setCurrent(const ThreadConfig& config) {
+    currentConfig() = config;
+}
+
+void ThreadConfig::setCpus(std::string_view list) {
+    m_cpus.clear();
+
+    // Workers pinned to cpus outside these would silently stay unpinned.
+    std::vector<int> allowed = allowedCpus();
+
+    while (!list.empty()) {
+        std::size_t comma = list.find(',');
+        std::string_view range = list.substr(0, comma);
+        list = comma == std::string_view::npos ? "" : list.substr(comma + 1);
+
+        std::size_t dash = range.find('-');
+        int first = parseInt(range.substr(0, dash), "cpu list");
+        int last = dash == std::string_view::npos
+                       ? first
+                       : parseInt(range.substr(dash + 1), "cpu list");
+        // Checked before the range is expanded, which also keeps cpu++ from
+        // overflowing.
+        if (last < first) {
+            throw std::invalid_argument("invalid cpu range '" +
+                                        std::string(range) + "'");
+        }
+        if (last >= cpuLimit) {
+            throw std::invalid_argument("cpu " + std::to_string(last) +
+                                        " is beyond the supported " +
+                                        std::to_string(cpuLimit));
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            if (!allowed.empty() and
+                std::ranges::find(allowed, cpu) == allowed.end()) {
+                throw std::invalid_argument("cpu " + std::to_string(cpu) +
+                                            " is offline or not available to "
+                                            "this process");
+            }
+            m_cpus.push_back(cpu);
+        }
+    }
+}
+
+void ThreadConfig::setSmtPolicy(std::string_view policy) {
+    if (policy == "all" or policy == "on") {
+        m_smtPolicy = SmtPolicy::all;
+    } else if (policy == "off") {
+        m_smtPolicy = SmtPolicy::off;
+    } else {
+        throw std::invalid_argument("invalid smt policy '" +
+                                    std::string(policy) + "', use all or off");
+    }
+}
+
+ThreadConfig& ThreadConfig::currentConfig() {
+    static ThreadConfig config;
+    return config;
+}
+
+void pinCurrentThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    // Reported once, every worker would fail alike.
+    static std::atomic_bool isReported = false;
+    if (error != 0 and !isReported.exchange(true)) {
+        std::cerr << "could not pin a thread to cpu " << cpu << ": "
+                  << std::strerror(error) << ", running unpinned\n";
+    }
+#else
+    static_cast<void>(cpu);
+#endif
+}
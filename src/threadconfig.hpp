@@ -0,0 +1,62 @@
+#ifndef _MANDELBROTTHREADCONFIG
+#define _MANDELBROTTHREADCONFIG
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Number of solver worker threads and the CPUs they are pinned to.
+// Read from the environment, then overridden by command line options:
+//   MANDELBROT_THREADS / --threads <count>
+//   MANDELBROT_CPUS    / --cpus <list>      e.g. 0-3,8,10
+//   MANDELBROT_SMT     / --smt <all|off>    off uses one CPU per physical core
+// Without a CPU list or with SMT on, workers aren't pinned, and default to one
+// per hardware thread.
+class ThreadConfig {
+public:
+    enum class SmtPolicy {
+        all,
+        off,
+    };
+
+    ThreadConfig();
+
+    static ThreadConfig fromEnvironment();
+
+    // Consumes the option at arguments[index] and its value if it is a thread
+    // option, advancing index past them. Returns false if it isn't one.
+    // Throws std::invalid_argument on malformed values, and on cpus the
+    // process can't run on.
+    bool parseOption(const std::vector<std::string_view>& arguments,
+                     std::size_t& index);
+
+    // Number of worker threads to use.
+    unsigned int threadCount() const;
+    void setThreadCount(unsigned int count);
+
+    // CPUs to pin worker threads to, worker i goes on cpu i % size.
+    // Empty if workers shouldn't be pinned.
+    std::vector<int> workerCpus() const;
+
+    std::string describe() const;
+
+    // Configuration used by newly constructed solvers.
+    static const ThreadConfig& current();
+    static void setCurrent(const ThreadConfig& config);
+
+private:
+    unsigned int m_threadCount; // 0 chooses automatically
+    std::vector<int> m_cpus;
+    SmtPolicy m_smtPolicy;
+
+    void setCpus(std::string_view list);
+    void setSmtPolicy(std::string_view policy);
+
+    static ThreadConfig& currentConfig();
+};
+
+// Pins the calling thread to one CPU, the first failure is reported on
+// stderr. Does nothing on unsupported platforms.
+void pinCurrentThread(int cpu);
+
+#endif
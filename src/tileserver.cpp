@@ -0,0 +1,492 @@
+#include "tileserver.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "formula.hpp"
+#include "grid2d.hpp"
+#include "pngwriter.hpp"
+#include "solver.hpp"
+#include "threadconfig.hpp"
+#include "trace.hpp"
+
+#if defined(__unix__) or defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define MANDELBROT_SOCKETS
+#endif
+
+namespace {
+
+template <typename T> bool parseNumber(std::string_view text, T& value) {
+    auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc() and end == text.data() + text.size();
+}
+
+#ifdef MANDELBROT_SOCKETS
+bool sendAll(int socket, const char* data, std::size_t length) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    while (length > 0) {
+        ssize_t sent = send(socket, data, length, flags);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+#endif
+
+} // namespace
+
+TileServer::TileServer(unsigned int workerCount, std::size_t cacheCapacity,
+                       int iterationMaximum)
+    : m_cacheCapacity(std::max<std::size_t>(cacheCapacity, 1)),
+      m_iterationMaximum(iterationMaximum) {
+    hits = 0;
+    renders = 0;
+    deduplicated = 0;
+    listenSocket = -1;
+    isStopping = false;
+    activeConnections = 0;
+
+    shading.setShadingFunction(3);
+
+    for (unsigned int i = 0; i < std::max(workerCount, 1u); i++) {
+        workers.emplace_back(
+            [this, i](std::stop_token stopToken) { workerLoop(stopToken, i); });
+    }
+}
+
+TileServer::~TileServer() {
+    stop();
+#ifdef MANDELBROT_SOCKETS
+    if (listenSocket >= 0) {
+        close(listenSocket);
+    }
+#endif
+
+    for (auto& worker : workers) {
+        worker.request_stop();
+    }
+    jobAvailable.notify_all();
+    workers.clear();
+
+    // Requests still queued can't be rendered any more.
+    for (Job& job : jobs) {
+        job.promise.set_exception(std::make_exception_ptr(
+            std::runtime_error("tile server stopped")));
+    }
+}
+
+std::optional<TileServer::Tile>
+TileServer::parsePath(std::string_view path) {
+    path = path.substr(0, path.find('?'));
+
+    std::vector<std::string_view> segments;
+    while (!path.empty()) {
+        if (path[0] != '/') {
+            return std::nullopt;
+        }
+        path.remove_prefix(1);
+        std::size_t end = std::min(path.find('/'), path.size());
+        segments.push_back(path.substr(0, end));
+        path.remove_prefix(end);
+    }
+    if (segments.size() != 5) {
+        return std::nullopt;
+    }
+
+    Tile tile;
+
+    std::optional<Formula> formula = formulaFromSlug(segments[0]);
+    if (!formula) {
+        return std::nullopt;
+    }
+    tile.formula = *formula;
+
+    if (segments[1] != "m") {
+        std::size_t comma = segments[1].find(',');
+        if (comma == std::string_view::npos or
+            !parseNumber(segments[1].substr(0, comma), tile.constantReal) or
+            !parseNumber(segments[1].substr(comma + 1), tile.constantImag)) {
+            return std::nullopt;
+        }
+        tile.mandelbrotMode = false;
+    }
+
+    std::string_view last = segments[4];
+    std::size_t dot = last.find('.');
+    if (dot == std::string_view::npos) {
+        return std::nullopt;
+    }
+    std::string_view extension = last.substr(dot + 1);
+    if (extension == "raw") {
+        tile.raw = true;
+    } else if (extension != "png") {
+        return std::nullopt;
+    }
+
+    if (!parseNumber(segments[2], tile.zoom) or
+        !parseNumber(segments[3], tile.x) or
+        !parseNumber(last.substr(0, dot), tile.y) or tile.zoom < 0 or
+        tile.zoom > maximumZoom) {
+        return std::nullopt;
+    }
+    long tileCount = 1l << tile.zoom;
+    if (tile.x < 0 or tile.x >= tileCount or tile.y < 0 or
+        tile.y >= tileCount) {
+        return std::nullopt;
+    }
+
+    return tile;
+}
+
+std::string TileServer::keyOf(const Tile& tile) {
+    std::ostringstream key;
+    key << std::setprecision(17) << formulaSlug(tile.formula) << "/";
+    if (tile.mandelbrotMode) {
+        key << "m";
+    } else {
+        key << tile.constantReal << "," << tile.constantImag;
+    }
+    key << "/" << tile.zoom << "/" << tile.x << "/" << tile.y
+        << (tile.raw ? ".raw" : ".png");
+    return key.str();
+}
+
+std::shared_ptr<const std::string> TileServer::getTile(const Tile& tile) {
+    std::string key = keyOf(tile);
+
+    std::shared_future<Body> future;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        auto entry = cacheEntries.find(key);
+        if (entry != cacheEntries.end()) {
+            cache.splice(cache.begin(), cache, entry->second);
+            hits++;
+            return entry->second->second;
+        }
+
+        auto pending = inFlight.find(key);
+        if (pending != inFlight.end()) {
+            future = pending->second;
+            deduplicated++;
+        } else {
+            Job job{key, tile, std::promise<Body>()};
+            future = job.promise.get_future().share();
+            inFlight.emplace(key, future);
+            renders++;
+
+            std::lock_guard<std::mutex> jobLock(jobMutex);
+            jobs.push_back(std::move(job));
+            jobAvailable.notify_one();
+        }
+    }
+
+    return future.get();
+}
+
+void TileServer::workerLoop(std::stop_token stopToken, unsigned int worker) {
+    // Tiles are rendered in parallel, one per worker, so each worker's solver
+    // runs on the worker's own thread.
+    std::vector<int> cpus = ThreadConfig::current().workerCpus();
+    if (!cpus.empty()) {
+        pinCurrentThread(cpus[worker % cpus.size()]);
+    }
+    Trace::setThreadName("tile worker");
+    ThreadConfig singleThread;
+    singleThread.setThreadCount(1);
+
+    Solver solver;
+    solver.setVerbose(false);
+    solver.setThreadConfig(singleThread);
+    solver.setMaxIterationCount(m_iterationMaximum);
+    Solver::FrameData frameData;
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            if (!jobAvailable.wait(lock, stopToken,
+                                   [this] { return !jobs.empty(); })) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        Body body;
+        std::exception_ptr exception;
+        try {
+            body = render(solver, job.tile, frameData);
+        } catch (...) {
+            exception = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+
+            // Cached before leaving inFlight, so requests always find one.
+            if (body) {
+                cache.emplace_front(job.key, body);
+                cacheEntries[job.key] = cache.begin();
+                if (cache.size() > m_cacheCapacity) {
+                    cacheEntries.erase(cache.back().first);
+                    cache.pop_back();
+                }
+            }
+            inFlight.erase(job.key);
+        }
+
+        if (body) {
+            job.promise.set_value(std::move(body));
+        } else {
+            job.promise.set_exception(exception);
+        }
+    }
+}
+
+TileServer::Body TileServer::render(Solver& solver, const Tile& tile,
+                                    Solver::FrameData& frameData) const {
+    double scale = std::ldexp(1.0, tile.zoom);
+    double tileWidth = 4.0 / scale;
+
+    solver.setFormula(tile.formula);
+    solver.setFractal(tile.mandelbrotMode, tile.constantReal,
+                      tile.constantImag);
+    solver.initializeGrid(tileSize, tileSize, -2.0 + (tile.x + 0.5) * tileWidth,
+                          2.0 - (tile.y + 0.5) * tileWidth, scale);
+    solver.solve();
+    solver.getFrameData(frameData);
+
+    const Grid2d<float>& grid = frameData.smoothIterationGrid;
+    if (tile.raw) {
+        const char* data = reinterpret_cast<const char*>(grid.data());
+        return std::make_shared<const std::string>(
+            data, data + grid.size() * sizeof(float));
+    }
+    return std::make_shared<const std::string>(encodePng(grid));
+}
+
+std::string
+TileServer::encodePng(const Grid2d<float>& smoothIterationGrid) const {
+    std::ostringstream output;
+    PngWriter writer(output, smoothIterationGrid.width(),
+                     smoothIterationGrid.height());
+
+    std::vector<unsigned char> pixels(smoothIterationGrid.size() * 3);
+    Shading::Colour background = shading.shade(1.0, 0.0);
+
+    for (std::size_t i = 0; i < smoothIterationGrid.size(); i++) {
+        Shading::Colour colour = background;
+        if (smoothIterationGrid[i] >= 0.0f) {
+            colour = shading.shadeSmooth(smoothIterationGrid[i], 0.0);
+        }
+        pixels[i * 3] = static_cast<unsigned char>(get<0>(colour));
+        pixels[i * 3 + 1] = static_cast<unsigned char>(get<1>(colour));
+        pixels[i * 3 + 2] = static_cast<unsigned char>(get<2>(colour));
+    }
+
+    writer.writeRows(pixels.data(), smoothIterationGrid.height());
+    writer.finish();
+
+    return output.str();
+}
+
+TileServer::Statistics TileServer::statistics() const {
+    return {hits, renders, deduplicated};
+}
+
+#ifdef MANDELBROT_SOCKETS
+
+int TileServer::listen(int port) {
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+        throw std::runtime_error("could not create socket");
+    }
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address),
+             addressLength) != 0 or
+        ::listen(listenSocket, 128) != 0 or
+        getsockname(listenSocket, reinterpret_cast<sockaddr*>(&address),
+                    &addressLength) != 0) {
+        // Saved first, close can overwrite it.
+        int error = errno;
+        close(listenSocket);
+        listenSocket = -1;
+        throw std::runtime_error("could not listen on port " +
+                                 std::to_string(port) + ": " +
+                                 std::strerror(error));
+    }
+
+    return ntohs(address.sin_port);
+}
+
+void TileServer::serve() {
+    const int socket = listenSocket;
+    while (!isStopping) {
+        {
+            std::unique_lock<std::mutex> lock(connectionMutex);
+            connectionsClosed.wait(lock, [this] {
+                return activeConnections < maximumConnections or isStopping;
+            });
+        }
+        int client = accept(socket, nullptr, nullptr);
+        if (client < 0) {
+            if (isStopping or errno != EINTR) {
+                break;
+            }
+            continue;
+        }
+
+        // Headers and body are sent separately, don't hold back the body.
+        int noDelay = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay,
+                   sizeof(noDelay));
+
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        if (isStopping) {
+            close(client);
+            break;
+        }
+        openSockets.insert(client);
+        activeConnections++;
+        std::thread(&TileServer::handleConnection, this, client).detach();
+    }
+}
+
+void TileServer::stop() {
+    std::unique_lock<std::mutex> lock(connectionMutex);
+    // Set under the lock so serve() can't miss it while waiting for a free
+    // connection.
+    isStopping = true;
+    connectionsClosed.notify_all();
+    // Wakes serve() from accept, the socket is closed by the destructor.
+    if (listenSocket >= 0) {
+        shutdown(listenSocket, SHUT_RDWR);
+    }
+    for (int socket : openSockets) {
+        shutdown(socket, SHUT_RDWR);
+    }
+    connectionsClosed.wait(lock, [this] { return activeConnections == 0; });
+}
+
+void TileServer::handleConnection(int socket) {
+    std::string buffer;
+    char received[4096];
+
+    while (true) {
+        std::size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t length = recv(socket, received, sizeof(received), 0);
+            if (length <= 0 or buffer.size() > 16384) {
+                headerEnd = std::string::npos;
+                break;
+            }
+            buffer.append(received, length);
+        }
+        if (headerEnd == std::string::npos) {
+            break;
+        }
+
+        std::string header = buffer.substr(0, headerEnd);
+        buffer.erase(0, headerEnd + 4);
+
+        // Request line: <method> <path> <version>
+        std::istringstream requestLine(header.substr(0, header.find("\r\n")));
+        std::string method, path, version;
+        requestLine >> method >> path >> version;
+
+        // Header names and values are case insensitive.
+        std::transform(header.begin(), header.end(), header.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        bool keepAlive = version == "HTTP/1.1" and
+                         header.find("connection: close") == std::string::npos;
+
+        std::string status = "200 OK";
+        std::string contentType;
+        Body body;
+        std::optional<Tile> tile;
+        if (method != "GET") {
+            status = "405 Method Not Allowed";
+        } else if (!(tile = parsePath(path))) {
+            status = "404 Not Found";
+        } else {
+            try {
+                body = getTile(*tile);
+                contentType =
+                    tile->raw ? "application/octet-stream" : "image/png";
+            } catch (const std::exception&) {
+                status = "503 Service Unavailable";
+            }
+        }
+
+        std::string response = "HTTP/1.1 " + status + "\r\n";
+        if (body) {
+            response += "Content-Type: " + contentType + "\r\n";
+        }
+        response += "Content-Length: " +
+                    std::to_string(body ? body->size() : 0) + "\r\n";
+        response += keepAlive ? "\r\n" : "Connection: close\r\n\r\n";
+
+        if (!sendAll(socket, response.data(), response.size()) or
+            (body and !sendAll(socket, body->data(), body->size())) or
+            !keepAlive) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(connectionMutex);
+    close(socket);
+    openSockets.erase(socket);
+    activeConnections--;
+    connectionsClosed.notify_all();
+}
+
+#else
+
+int TileServer::listen(int) {
+    throw std::runtime_error("the tile server isn't supported on this "
+                             "platform");
+}
+
+void TileServer::serve() {}
+
+void TileServer::stop() {}
+
+void TileServer::handleConnection(int) {}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef _MANDELBROTTILESERVER
+#define _MANDELBROTTILESERVER
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "formula.hpp"
+#include "shading.hpp"
+#include "solver.hpp"
+
+// Serves map style tiles over HTTP on localhost, rendered by a pool of solver
+// workers and kept in a bounded LRU cache.
+// Tiles are addressed as /<formula>/<constant>/<zoom>/<x>/<y>.<png|raw>:
+//   formula   formula name with spaces replaced by dashes, e.g. burning-ship
+//   constant  m for the mandelbrot set, or <real>,<imag> for a julia set
+//   zoom      splits the square from -2 + 2i to 2 - 2i into 2^zoom by 2^zoom
+//             tiles, x to the right and y downwards
+// PNG tiles are coloured by smooth iteration count alone, so neighbouring tiles
+// match. Raw tiles are the smooth iteration counts as 32-bit floats in machine
+// byte order, row by row, negative inside the set.
+class TileServer {
+public:
+    struct Tile {
+        Formula formula = Formula::mandelbrot;
+        bool mandelbrotMode = true;
+        double constantReal = 0.0, constantImag = 0.0;
+        int zoom = 0;
+        long x = 0, y = 0;
+        bool raw = false;
+    };
+    static constexpr int tileSize = 256;
+    // Pixels are 2^-(zoom + 6) wide, at zoom 40 still a few dozen doubles
+    // apart anywhere in the square. Deeper tiles would come out as blocks.
+    static constexpr int maximumZoom = 40;
+    // Connections served at once, later ones wait in the listen backlog.
+    static constexpr int maximumConnections = 64;
+
+    TileServer(unsigned int workerCount, std::size_t cacheCapacity,
+               int iterationMaximum);
+    ~TileServer();
+
+    // Returns the tile addressed by a request path, if it addresses one.
+    static std::optional<Tile> parsePath(std::string_view path);
+
+    // Returns the encoded tile from the cache, by waiting for a render of the
+    // same tile that is already in progress, or by rendering it on a worker.
+    // Thread safe.
+    std::shared_ptr<const std::string> getTile(const Tile& tile);
+
+    // Listens on 127.0.0.1, where port 0 picks a free port. Returns the port.
+    // Throws std::runtime_error if the port can't be opened.
+    int listen(int port);
+    // Accepts connections until stop() is called.
+    void serve();
+    // Stops serving and closes all connections.
+    void stop();
+
+    struct Statistics {
+        unsigned long hits = 0;
+        unsigned long renders = 0;
+        unsigned long deduplicated = 0;
+    };
+    Statistics statistics() const;
+
+private:
+    using Body = std::shared_ptr<const std::string>;
+
+    std::size_t m_cacheCapacity;
+    int m_iterationMaximum;
+
+    // Most recently used tiles at the front.
+    std::list<std::pair<std::string, Body>> cache;
+    std::unordered_map<std::string,
+                       std::list<std::pair<std::string, Body>>::iterator>
+        cacheEntries;
+    // Tiles being rendered, shared with requests for the same tile.
+    std::unordered_map<std::string, std::shared_future<Body>> inFlight;
+    std::mutex cacheMutex;
+
+    std::atomic_ulong hits, renders, deduplicated;
+
+    struct Job {
+        std::string key;
+        Tile tile;
+        std::promise<Body> promise;
+    };
+    std::deque<Job> jobs;
+    std::mutex jobMutex;
+    std::condition_variable_any jobAvailable;
+    std::vector<std::jthread> workers;
+
+    Shading shading;
+
+    int listenSocket;
+    std::atomic_bool isStopping;
+    // Connections are handled on their own threads, up to
+    // maximumConnections. stop() closes their sockets and waits for them to
+    // finish.
+    std::set<int> openSockets;
+    int activeConnections;
+    std::mutex connectionMutex;
+    std::condition_variable connectionsClosed;
+
+    static std::string keyOf(const Tile& tile);
+
+    // Takes jobs from the queue until stopped, each worker with its own
+    // single threaded solver.
+    void workerLoop(std::stop_token stopToken, unsigned int worker);
+
+    Body render(Solver& solver, const Tile& tile,
+                Solver::FrameData& frameData) const;
+
+    std::string encodePng(const Grid2d<float>& smoothIterationGrid) const;
+
+    void handleConnection(int socket);
+};
+
+#endif
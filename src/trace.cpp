@@ -0,0 +1,212 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Written only by the thread that owns the buffer, and read by dump() while
+// it may be writing, so every field is atomic. Relaxed stores compile to
+// plain ones.
+struct Span {
+    std::atomic<const char*> name;
+    std::atomic_uint64_t start, end;
+    std::atomic_int thread;
+};
+
+struct ThreadBuffer {
+    bool isInUse;
+    // Total spans recorded, the ring holds the last Trace::capacity. Only the
+    // owner stores it, after the span is written.
+    std::atomic_size_t recorded = 0;
+    std::unique_ptr<Span[]> spans;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    // Names by thread id, ids start at 1.
+    std::vector<std::string> threadNames;
+    std::string path;
+    std::uint64_t epoch = 0;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// The calling thread's buffer, handed back when the thread exits. Solver
+// workers are started for every pass, so they reuse a few buffers instead of
+// each taking a new one. Spans carry the id of the thread that recorded them,
+// so threads sharing a buffer over time still get their own tracks.
+struct BufferHandle {
+    ThreadBuffer* buffer = nullptr;
+    int thread = 0;
+    const char* name = "worker";
+
+    ~BufferHandle() {
+        if (buffer != nullptr) {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            buffer->isInUse = false;
+        }
+    }
+};
+
+thread_local BufferHandle handle;
+
+ThreadBuffer& threadBuffer() {
+    if (handle.buffer != nullptr) [[likely]] {
+        return *handle.buffer;
+    }
+
+    Registry& instance = registry();
+    std::lock_guard<std::mutex> lock(instance.mutex);
+    instance.threadNames.push_back(handle.name);
+    handle.thread = instance.threadNames.size();
+    for (auto& buffer : instance.buffers) {
+        if (!buffer->isInUse) {
+            handle.buffer = buffer.get();
+            break;
+        }
+    }
+    if (handle.buffer == nullptr) {
+        instance.buffers.push_back(std::make_unique<ThreadBuffer>());
+        handle.buffer = instance.buffers.back().get();
+        handle.buffer->spans = std::make_unique<Span[]>(Trace::capacity);
+    }
+    handle.buffer->isInUse = true;
+    return *handle.buffer;
+}
+
+} // namespace
+
+void Trace::start(const std::string& path) {
+    Registry& instance = registry();
+    {
+        std::lock_guard<std::mutex> lock(instance.mutex);
+        instance.path = path;
+        instance.epoch = now();
+    }
+    enabled = true;
+}
+
+void Trace::setThreadName(const char* name) {
+    handle.name = name;
+    if (handle.buffer != nullptr) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        registry().threadNames[handle.thread - 1] = name;
+    }
+}
+
+void Trace::record(const char* name, std::uint64_t start, std::uint64_t end) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::size_t index = buffer.recorded.load(std::memory_order_relaxed);
+    // Orders the previous span's publication before its slot's reuse, which
+    // dump() relies on to tell overwritten spans apart.
+    std::atomic_thread_fence(std::memory_order_release);
+    Span& span = buffer.spans[index % capacity];
+    span.name.store(name, std::memory_order_relaxed);
+    span.start.store(start, std::memory_order_relaxed);
+    span.end.store(end, std::memory_order_relaxed);
+    span.thread.store(handle.thread, std::memory_order_relaxed);
+    buffer.recorded.store(index + 1, std::memory_order_release);
+}
+
+void Trace::dump() {
+    if (!isEnabled()) {
+        return;
+    }
+
+    Registry& instance = registry();
+    std::lock_guard<std::mutex> registryLock(instance.mutex);
+
+    std::ofstream file(instance.path, std::ios::trunc);
+    if (!file) {
+        std::cerr << "could not open " << instance.path << "\n";
+        return;
+    }
+
+    // Microseconds since start().
+    auto timestamp = [&instance](std::uint64_t time) {
+        return static_cast<double>(time - instance.epoch) * 1e-3;
+    };
+
+    file << std::fixed << std::setprecision(3)
+         << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    // Copies of each buffer's spans, taken without stopping their owners.
+    struct Copy {
+        const char* name;
+        std::uint64_t start, end;
+        int thread;
+    };
+    std::vector<Copy> spans;
+    std::vector<Copy> copied;
+    for (auto& buffer : instance.buffers) {
+        std::size_t recorded = buffer->recorded.load(std::memory_order_acquire);
+        std::size_t first = recorded > capacity ? recorded - capacity : 0;
+        copied.clear();
+        for (std::size_t i = first; i < recorded; i++) {
+            const Span& span = buffer->spans[i % capacity];
+            copied.push_back({span.name.load(std::memory_order_relaxed),
+                              span.start.load(std::memory_order_relaxed),
+                              span.end.load(std::memory_order_relaxed),
+                              span.thread.load(std::memory_order_relaxed)});
+        }
+
+        // Slots reused while copying, including the one being written, are
+        // dropped.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::size_t after = buffer->recorded.load(std::memory_order_relaxed);
+        std::size_t overwritten = after + 1 > capacity ? after + 1 - capacity
+                                                       : 0;
+        for (std::size_t i = std::max(first, overwritten); i < recorded; i++) {
+            spans.push_back(copied[i - first]);
+        }
+    }
+
+    std::vector<bool> hasSpans(instance.threadNames.size() + 1, false);
+    for (const Copy& span : spans) {
+        if (span.start >= instance.epoch) {
+            hasSpans[span.thread] = true;
+        }
+    }
+    bool isFirst = true;
+    for (std::size_t thread = 1; thread < hasSpans.size(); thread++) {
+        if (!hasSpans[thread]) {
+            continue;
+        }
+        file << (isFirst ? "" : ",\n")
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+             << thread << ",\"args\":{\"name\":\""
+             << instance.threadNames[thread - 1] << "\"}}";
+        isFirst = false;
+    }
+
+    std::size_t spanCount = 0;
+    for (const Copy& span : spans) {
+        if (span.start < instance.epoch) {
+            continue;
+        }
+        file << (isFirst ? "" : ",\n") << "{\"name\":\"" << span.name
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread
+             << ",\"ts\":" << timestamp(span.start)
+             << ",\"dur\":" << timestamp(span.end) - timestamp(span.start)
+             << "}";
+        isFirst = false;
+        spanCount++;
+    }
+    file << "\n]}\n";
+
+    std::cout << "wrote " << spanCount << " trace spans from "
+              << std::ranges::count(hasSpans, true) << " threads to "
+              << instance.path << "\n";
+}
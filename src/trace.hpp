@@ -0,0 +1,81 @@
+#ifndef _MANDELBROTTRACE
+#define _MANDELBROTTRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Timeline of scoped spans, for finding stalls between threads.
+// Spans are compiled in with MANDELBROT_TRACE (make TRACE=1), otherwise
+// TRACE_SCOPE expands to nothing. Compiled in, spans are only recorded after
+// start(), before that a span costs one relaxed load.
+// Each thread records into a ring buffer it owns without locking, dump()
+// copies them and writes the spans as Chrome trace event JSON, one track per
+// thread, which Perfetto and chrome://tracing load.
+class Trace {
+public:
+#ifdef MANDELBROT_TRACE
+    static constexpr bool isCompiledIn = true;
+#else
+    static constexpr bool isCompiledIn = false;
+#endif
+    // Spans kept per thread, older ones are overwritten.
+    static constexpr std::size_t capacity = 1 << 16;
+
+    // Starts recording spans, for dump() to write to path.
+    static void start(const std::string& path);
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Names the calling thread in the trace.
+    static void setThreadName(const char* name);
+
+    // Writes the recorded spans, if recording was started. Recording
+    // continues. Thread safe.
+    static void dump();
+
+    // name must outlive the trace, like a string literal.
+    static void record(const char* name, std::uint64_t start,
+                       std::uint64_t end);
+
+    static std::uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+private:
+    static inline std::atomic_bool enabled = false;
+};
+
+// Records a span from construction to destruction.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name)
+        : m_name(name), m_start(Trace::isEnabled() ? Trace::now() : 0) {}
+    ~TraceScope() {
+        if (m_start != 0) {
+            Trace::record(m_name, m_start, Trace::now());
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name;
+    std::uint64_t m_start;
+};
+
+#ifdef MANDELBROT_TRACE
+#define MANDELBROT_TRACE_CONCATENATE(a, b) a##b
+#define MANDELBROT_TRACE_VARIABLE(line)                                        \
+    MANDELBROT_TRACE_CONCATENATE(traceScope, line)
+#define TRACE_SCOPE(name) TraceScope MANDELBROT_TRACE_VARIABLE(__LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+#endif